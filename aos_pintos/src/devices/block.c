@@ -3,7 +3,18 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Largest number of sectors the worker merges into one transfer. */
+#define BLOCK_MERGE_MAX 16
+
+/* Ticks a queued read or write may wait before it is served ahead
+   of the elevator order. */
+#define BLOCK_READ_DEADLINE (TIMER_FREQ / 10)
+#define BLOCK_WRITE_DEADLINE (TIMER_FREQ / 2)
 
 /* A block device. */
 struct block
@@ -19,6 +30,28 @@ struct block
 
   unsigned long long read_cnt;  /* Number of sectors read. */
   unsigned long long write_cnt; /* Number of sectors written. */
+  unsigned long long multi_cnt; /* Number of multi-sector transfers. */
+  unsigned long long irq_saved; /* Completion interrupts saved by them. */
+
+  /* Request queue.  Only whole disks have one; partitions pass
+     requests on to the disk they live on. */
+  bool queued;                 /* Has a queue and worker thread? */
+  struct lock queue_lock;      /* Protects the members below. */
+  struct condition queue_cond; /* Signaled when a request arrives. */
+  struct list queue;           /* Pending requests, in sector order. */
+  struct list fifo;            /* Pending requests, oldest first. */
+  block_sector_t head;         /* Sector after the last one served. */
+  size_t depth;                /* Number of pending requests. */
+  void *merge_buf;             /* Bounce buffer for merged requests. */
+
+  /* Queue statistics. */
+  unsigned long long submit_cnt;  /* Number of requests queued. */
+  unsigned long long depth_sum;   /* Sum of depths seen on submit. */
+  size_t max_depth;               /* Largest depth seen. */
+  unsigned long long service_cnt; /* Number of requests served. */
+  int64_t latency_sum;            /* Sum of submit-to-done ticks. */
+  unsigned long long merge_cnt;   /* Requests merged into another. */
+  unsigned long long expired_cnt; /* Requests served by deadline. */
 };
 
 /* List of all block devices. */
@@ -101,15 +134,180 @@ static void check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Moves CNT sectors starting at SECTOR between BLOCK and BUFFER
+   by calling the driver directly, from the device into BUFFER
+   unless WRITE.  Returns the number of completion interrupts the
+   transfer took. */
+static size_t block_dispatch (struct block *block, bool write,
+                              block_sector_t sector, size_t cnt,
+                              void *buffer)
+{
+  uint8_t *p = buffer;
+  size_t irq_cnt;
+  size_t i;
+
+  if (cnt == 1 || (write ? block->ops->write_multiple == NULL
+                         : block->ops->read_multiple == NULL))
+    {
+      for (i = 0; i < cnt; i++)
+        if (write)
+          block->ops->write (block->aux, sector + i,
+                             p + i * BLOCK_SECTOR_SIZE);
+        else
+          block->ops->read (block->aux, sector + i,
+                            p + i * BLOCK_SECTOR_SIZE);
+      return cnt;
+    }
+
+  if (write)
+    irq_cnt = block->ops->write_multiple (block->aux, sector, cnt, buffer);
+  else
+    irq_cnt = block->ops->read_multiple (block->aux, sector, cnt, buffer);
+  block->multi_cnt++;
+  block->irq_saved += cnt - irq_cnt;
+  return irq_cnt;
+}
+
+/* Initializes R as a request to move CNT sectors starting at
+   SECTOR between a block device and BUFFER, from the device into
+   BUFFER unless WRITE.  BUFFER must be in kernel memory, because
+   the transfer happens in the device's worker thread.
+
+   If COMPLETE is non-null, the worker thread calls it with R and
+   AUX once the transfer is done, and R then belongs to COMPLETE
+   again.  Otherwise, wait for the transfer with block_wait(). */
+void block_request_init (struct block_request *r, bool write,
+                         block_sector_t sector, size_t cnt, void *buffer,
+                         block_complete_func *complete, void *aux)
+{
+  ASSERT (r != NULL);
+  ASSERT (cnt > 0);
+  ASSERT (is_kernel_vaddr (buffer));
+
+  r->write = write;
+  r->sector = sector;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  r->complete = complete;
+  r->aux = aux;
+  r->irq_cnt = 0;
+  sema_init (&r->done, 0);
+}
+
+/* Returns true if request A's first sector is below B's. */
+static bool request_less (const struct list_elem *a_,
+                          const struct list_elem *b_, void *aux UNUSED)
+{
+  const struct block_request *a =
+      list_entry (a_, struct block_request, sort_elem);
+  const struct block_request *b =
+      list_entry (b_, struct block_request, sort_elem);
+  return a->sector < b->sector;
+}
+
+/* Queues request R, initialized with block_request_init(), on
+   BLOCK and returns without waiting for it. */
+void block_submit (struct block *block, struct block_request *r)
+{
+  check_sector (block, r->sector);
+  check_sector (block, r->sector + r->cnt - 1);
+  ASSERT (!r->write || block->type != BLOCK_FOREIGN);
+
+  if (r->write)
+    block->write_cnt += r->cnt;
+  else
+    block->read_cnt += r->cnt;
+
+  if (!block->queued)
+    {
+      /* No queue of its own: a partition forwards to the queue of
+         the disk it lives on, so just pass the request down. */
+      r->irq_cnt = block_dispatch (block, r->write, r->sector, r->cnt,
+                                   r->buffer);
+      if (r->complete != NULL)
+        r->complete (r, r->aux);
+      else
+        sema_up (&r->done);
+      return;
+    }
+
+  lock_acquire (&block->queue_lock);
+  r->submitted = timer_ticks ();
+  r->deadline = r->submitted + (r->write ? BLOCK_WRITE_DEADLINE
+                                         : BLOCK_READ_DEADLINE);
+  list_insert_ordered (&block->queue, &r->sort_elem, request_less, NULL);
+  list_push_back (&block->fifo, &r->fifo_elem);
+  block->depth++;
+  block->submit_cnt++;
+  block->depth_sum += block->depth;
+  if (block->depth > block->max_depth)
+    block->max_depth = block->depth;
+  cond_signal (&block->queue_cond, &block->queue_lock);
+  lock_release (&block->queue_lock);
+}
+
+/* Waits for request R, submitted without a completion function,
+   to finish.  Returns the number of completion interrupts it
+   took. */
+size_t block_wait (struct block_request *r)
+{
+  ASSERT (r->complete == NULL);
+  sema_down (&r->done);
+  return r->irq_cnt;
+}
+
+/* Submits a request to move CNT sectors between BLOCK and
+   BUFFER and waits for it.  BUFFER may be a user address, in
+   which case the data goes through a kernel bounce buffer that
+   is copied in the calling thread, where the user mapping is
+   valid. */
+static size_t block_transfer (struct block *block, bool write,
+                              block_sector_t sector, size_t cnt,
+                              void *buffer)
+{
+  struct block_request r;
+  void *bounce = NULL;
+  size_t irq_cnt;
+
+  if (!is_kernel_vaddr (buffer))
+    {
+      bounce = malloc (cnt * BLOCK_SECTOR_SIZE);
+      if (bounce == NULL)
+        {
+          /* Fall back to the synchronous path. */
+          check_sector (block, sector);
+          check_sector (block, sector + cnt - 1);
+          if (write)
+            block->write_cnt += cnt;
+          else
+            block->read_cnt += cnt;
+          return block_dispatch (block, write, sector, cnt, buffer);
+        }
+      if (write)
+        memcpy (bounce, buffer, cnt * BLOCK_SECTOR_SIZE);
+    }
+
+  block_request_init (&r, write, sector, cnt,
+                      bounce != NULL ? bounce : buffer, NULL, NULL);
+  block_submit (block, &r);
+  irq_cnt = block_wait (&r);
+
+  if (bounce != NULL)
+    {
+      if (!write)
+        memcpy (buffer, bounce, cnt * BLOCK_SECTOR_SIZE);
+      free (bounce);
+    }
+  return irq_cnt;
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
    per-block device locking is unneeded. */
 void block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_transfer (block, false, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -120,10 +318,202 @@ void block_read (struct block *block, block_sector_t sector, void *buffer)
 void block_write (struct block *block, block_sector_t sector,
                   const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_transfer (block, true, sector, 1, (void *) buffer);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that support it move the whole run with one
+   command instead of one command per sector.
+   Returns the number of completion interrupts the transfer took.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+size_t block_read_multiple (struct block *block, block_sector_t sector,
+                            size_t cnt, void *buffer)
+{
+  ASSERT (cnt > 0);
+  return block_transfer (block, false, sector, cnt, buffer);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving the
+   data, with the number of completion interrupts it took.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+size_t block_write_multiple (struct block *block, block_sector_t sector,
+                             size_t cnt, const void *buffer)
+{
+  ASSERT (cnt > 0);
+  return block_transfer (block, true, sector, cnt, (void *) buffer);
+}
+
+/* Removes from BLOCK's queue the request to serve next and any
+   requests that can be merged with it, storing them in BATCH in
+   sector order.  Returns the number of requests removed.
+
+   The next request is the oldest one if its deadline has passed,
+   and otherwise the first at or above the sector after the last
+   one served, wrapping around to the lowest sector (C-SCAN).
+   Requests that continue it on disk in the same direction are
+   merged as long as the total fits in BLOCK_MERGE_MAX sectors.
+   BLOCK's queue_lock must be held and the queue non-empty. */
+static size_t block_pick (struct block *block, struct block_request **batch)
+{
+  struct block_request *r =
+      list_entry (list_front (&block->fifo), struct block_request,
+                  fifo_elem);
+  struct list_elem *e;
+  size_t sectors, n = 0;
+
+  if (timer_ticks () < r->deadline)
+    {
+      for (e = list_begin (&block->queue); e != list_end (&block->queue);
+           e = list_next (e))
+        if (list_entry (e, struct block_request, sort_elem)->sector >=
+            block->head)
+          break;
+      if (e == list_end (&block->queue))
+        e = list_begin (&block->queue);
+      r = list_entry (e, struct block_request, sort_elem);
+    }
+  else
+    block->expired_cnt++;
+
+  sectors = r->cnt;
+  for (;;)
+    {
+      struct list_elem *next = list_next (&r->sort_elem);
+
+      list_remove (&r->sort_elem);
+      list_remove (&r->fifo_elem);
+      batch[n++] = r;
+      if (next == list_end (&block->queue))
+        break;
+      r = list_entry (next, struct block_request, sort_elem);
+      if (r->write != batch[0]->write ||
+          r->sector != batch[n - 1]->sector + batch[n - 1]->cnt ||
+          sectors + r->cnt > BLOCK_MERGE_MAX)
+        break;
+      sectors += r->cnt;
+    }
+
+  block->depth -= n;
+  block->head = batch[0]->sector + sectors;
+  return n;
+}
+
+/* Serves the N requests in BATCH, which are contiguous on BLOCK
+   and go in the same direction, with a single transfer, and
+   completes them. */
+static void block_service (struct block *block, struct block_request **batch,
+                           size_t n)
+{
+  bool write = batch[0]->write;
+  size_t irq_cnt, i;
+
+  if (n == 1)
+    irq_cnt = block_dispatch (block, write, batch[0]->sector, batch[0]->cnt,
+                              batch[0]->buffer);
+  else
+    {
+      /* Gather the requests into the merge buffer so the driver
+         sees one run of sectors. */
+      uint8_t *p = block->merge_buf;
+      size_t sectors = 0;
+
+      for (i = 0; i < n; i++)
+        {
+          if (write)
+            memcpy (p + sectors * BLOCK_SECTOR_SIZE, batch[i]->buffer,
+                    batch[i]->cnt * BLOCK_SECTOR_SIZE);
+          sectors += batch[i]->cnt;
+        }
+      irq_cnt = block_dispatch (block, write, batch[0]->sector, sectors, p);
+      sectors = 0;
+      for (i = 0; i < n; i++)
+        {
+          if (!write)
+            memcpy (batch[i]->buffer, p + sectors * BLOCK_SECTOR_SIZE,
+                    batch[i]->cnt * BLOCK_SECTOR_SIZE);
+          sectors += batch[i]->cnt;
+        }
+      block->merge_cnt += n - 1;
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      struct block_request *r = batch[i];
+
+      block->service_cnt++;
+      block->latency_sum += timer_elapsed (r->submitted);
+      r->irq_cnt = irq_cnt;
+      if (r->complete != NULL)
+        r->complete (r, r->aux);
+      else
+        sema_up (&r->done);
+    }
+}
+
+/* Worker thread for BLOCK_, which drains its request queue. */
+static void block_worker (void *block_)
+{
+  struct block *block = block_;
+
+  for (;;)
+    {
+      struct block_request *batch[BLOCK_MERGE_MAX];
+      size_t n;
+
+      lock_acquire (&block->queue_lock);
+      while (list_empty (&block->queue))
+        cond_wait (&block->queue_cond, &block->queue_lock);
+      n = block_pick (block, batch);
+      lock_release (&block->queue_lock);
+
+      block_service (block, batch, n);
+    }
+}
+
+/* Gives BLOCK a request queue and starts its worker thread.
+   Until then, requests to BLOCK are served synchronously by the
+   caller. */
+static void block_start_queue (struct block *block)
+{
+  char name[16];
+
+  block->merge_buf = malloc (BLOCK_MERGE_MAX * BLOCK_SECTOR_SIZE);
+  if (block->merge_buf == NULL)
+    PANIC ("Failed to allocate merge buffer for block device %s",
+           block->name);
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_cond);
+  list_init (&block->queue);
+  list_init (&block->fifo);
+  block->head = 0;
+  block->depth = 0;
+  block->queued = true;
+
+  snprintf (name, sizeof name, "%.12s-io", block->name);
+  if (thread_create (name, PRI_MAX, block_worker, block) == TID_ERROR)
+    PANIC ("Failed to start worker thread for block device %s",
+           block->name);
+}
+
+/* Starts the request queues of the whole disks registered so
+   far.  thread_create() opens the new thread's executable, so
+   this must not be called before the file system is up. */
+void block_start_queues (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      if (block->type == BLOCK_RAW && !block->queued)
+        block_start_queue (block);
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -138,6 +528,7 @@ enum block_type block_type (struct block *block) { return block->type; }
 /* Prints statistics for each block device used for a Pintos role. */
 void block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
@@ -145,11 +536,30 @@ void block_print_stats (void)
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
-          printf ("%s (%s): %llu reads, %llu writes\n", block->name,
-                  block_type_name (block->type), block->read_cnt,
-                  block->write_cnt);
+          printf ("%s (%s): %llu reads, %llu writes, "
+                  "%llu multi-sector transfers saving %llu interrupts\n",
+                  block->name, block_type_name (block->type),
+                  block->read_cnt, block->write_cnt, block->multi_cnt,
+                  block->irq_saved);
         }
     }
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+      if (block->queued && block->submit_cnt > 0)
+        printf ("%s queue: %llu requests, depth avg %llu.%02llu max %zu, "
+                "latency avg %lld.%02lld ticks, %llu merged, "
+                "%llu past deadline\n",
+                block->name, block->submit_cnt,
+                block->depth_sum / block->submit_cnt,
+                block->depth_sum * 100 / block->submit_cnt % 100,
+                block->max_depth,
+                block->latency_sum / (int64_t) block->service_cnt,
+                block->latency_sum * 100 / (int64_t) block->service_cnt % 100,
+                block->merge_cnt, block->expired_cnt);
+    }
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -173,6 +583,16 @@ struct block *block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->multi_cnt = 0;
+  block->irq_saved = 0;
+  block->queued = false;
+  block->submit_cnt = 0;
+  block->depth_sum = 0;
+  block->max_depth = 0;
+  block->service_cnt = 0;
+  block->latency_sum = 0;
+  block->merge_cnt = 0;
+  block->expired_cnt = 0;
 
   printf ("%s: %'" PRDSNu " sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -3,6 +3,9 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
+#include <stdbool.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,9 +56,47 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+size_t block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                            void *);
+size_t block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                             const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous requests.
+   block_read(), block_write() and the _multiple variants submit
+   a request and wait for it; callers that have other work to do
+   can instead submit a request and be told when it is done. */
+
+struct block_request;
+typedef void block_complete_func (struct block_request *, void *aux);
+
+/* A request to move sectors between a block device and memory. */
+struct block_request
+{
+  bool write;                   /* Device to memory unless true. */
+  block_sector_t sector;        /* First sector. */
+  size_t cnt;                   /* Number of sectors. */
+  void *buffer;                 /* CNT * BLOCK_SECTOR_SIZE bytes. */
+  block_complete_func *complete; /* Called when done, or null. */
+  void *aux;                    /* Passed to COMPLETE. */
+  size_t irq_cnt;               /* Completion interrupts taken. */
+
+  /* Owned by the block layer. */
+  struct list_elem sort_elem;   /* Element in queue, by sector. */
+  struct list_elem fifo_elem;   /* Element in queue, by age. */
+  int64_t submitted;            /* Tick the request was queued. */
+  int64_t deadline;             /* Tick to serve it by. */
+  struct semaphore done;        /* Up'd when done, if no COMPLETE. */
+};
+
+void block_request_init (struct block_request *, bool write, block_sector_t,
+                         size_t cnt, void *buffer, block_complete_func *,
+                         void *aux);
+void block_submit (struct block *, struct block_request *);
+size_t block_wait (struct block_request *);
+void block_start_queues (void);
+
 /* Statistics. */
 void block_print_stats (void);
 
@@ -65,6 +106,14 @@ struct block_operations
 {
   void (*read) (void *aux, block_sector_t, void *buffer);
   void (*write) (void *aux, block_sector_t, const void *buffer);
+
+  /* Optional.  Transfer CNT consecutive sectors and return the
+     number of completion interrupts waited for.  If null, the
+     block layer falls back to one read or write per sector. */
+  size_t (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+  size_t (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
 };
 
 struct block *block_register (const char *name, enum block_type,
@@ -8,10 +8,17 @@
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].  Data moves by
+   bus-master DMA when a PCI IDE controller that supports it is
+   found, and by programmed I/O (PIO) otherwise. */
+
+/* -pio: Never use DMA, even if the controller supports it. */
+bool ide_pio_only;
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)   /* Data. */
@@ -34,6 +41,7 @@
 #define STA_BSY 0x80  /* Busy. */
 #define STA_DRDY 0x40 /* Device Ready. */
 #define STA_DRQ 0x08  /* Data Request. */
+#define STA_ERR 0x01  /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04 /* Software Reset. */
@@ -49,6 +57,56 @@
 #define CMD_IDENTIFY_DEVICE 0xec    /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20  /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30 /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4      /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5     /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6  /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8           /* READ DMA. */
+#define CMD_WRITE_DMA 0xca          /* WRITE DMA. */
+
+/* Largest DRQ block size we ask for with SET MULTIPLE MODE. */
+#define MAX_MULTIPLE 16
+
+/* Largest sector count a single command can carry (a count of 0
+   in the Sector Count register means 256). */
+#define MAX_NSECT 256
+
+/* Bus master IDE register port addresses, relative to a
+   channel's bus master base [SFF-8038i]. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01 /* Start/stop bus master. */
+#define BM_CMD_READ 0x08  /* 1=write to memory (disk read). */
+
+/* Bus master Status Register bits. */
+#define BM_STA_ACTIVE 0x01 /* Bus master active. */
+#define BM_STA_ERR 0x02    /* DMA error, write 1 to clear. */
+#define BM_STA_IRQ 0x04    /* Interrupt raised, write 1 to clear. */
+
+/* A physical region descriptor, one entry in the table that tells
+   the bus master where to move data.  A region may not cross a
+   64 kB boundary; a byte count of 0 means 64 kB. */
+struct prd
+{
+  uint32_t addr;  /* Physical base address, must be even. */
+  uint16_t size;  /* Byte count. */
+  uint16_t flags; /* PRD_EOT on the last entry. */
+};
+
+#define PRD_EOT 0x8000 /* End of table. */
+
+/* PCI configuration space access ports and the header fields we
+   need to find the IDE controller. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+#define PCI_REG_ID 0x00      /* Vendor ID in low 16 bits. */
+#define PCI_REG_COMMAND 0x04 /* Command in low 16 bits. */
+#define PCI_REG_CLASS 0x08   /* Class, subclass, prog-if, revision. */
+#define PCI_REG_BAR4 0x20    /* Bus master base address. */
+#define PCI_CMD_IO 0x0001    /* Respond to I/O space accesses. */
+#define PCI_CMD_MASTER 0x0004 /* Enable bus mastering. */
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +115,9 @@ struct ata_disk
   struct channel *channel; /* Channel that disk is attached to. */
   int dev_no;              /* Device 0 or 1 for master or slave. */
   bool is_ata;             /* Is device an ATA disk? */
+  int multiple;            /* Sectors per DRQ block for READ/WRITE
+                              MULTIPLE, or 0 if unsupported. */
+  bool dma;                /* Use DMA for this disk? */
 };
 
 /* An ATA channel (aka controller).
@@ -72,6 +133,9 @@ struct channel
                                any interrupt would be spurious. */
   struct semaphore completion_wait; /* Up'd by interrupt handler. */
 
+  uint16_t bm_base;  /* Bus master base I/O port, 0 if none. */
+  struct prd *prdt;  /* PRD table, one page from the kernel pool. */
+
   struct ata_disk devices[2]; /* The devices on this channel. */
 };
 
@@ -79,14 +143,24 @@ struct channel
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/* Statistics. */
+static unsigned long long dma_cnt;     /* # of DMA commands. */
+static unsigned long long dma_sectors; /* # of sectors moved by DMA. */
+static unsigned long long pio_sectors; /* # of sectors moved by PIO. */
+
 static struct block_operations ide_operations;
 
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
+static void set_multiple_mode (struct ata_disk *, int hw_multiple);
+static uint16_t find_bus_master (void);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
+static bool dma_usable (const struct ata_disk *, const void *buffer);
+static size_t dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                            void *buffer, bool write);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
@@ -101,6 +175,7 @@ static void interrupt_handler (struct intr_frame *);
 void ide_init (void)
 {
   size_t chan_no;
+  uint16_t bm_base = ide_pio_only ? 0 : find_bus_master ();
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
@@ -126,6 +201,17 @@ void ide_init (void)
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
 
+      /* Set up bus mastering.  Each channel has 8 bytes of bus
+         master registers, primary first. */
+      c->bm_base = 0;
+      c->prdt = NULL;
+      if (bm_base != 0)
+        {
+          c->prdt = palloc_get_page (PAL_ZERO);
+          if (c->prdt != NULL)
+            c->bm_base = bm_base + chan_no * 8;
+        }
+
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
         {
@@ -135,6 +221,8 @@ void ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -276,13 +364,21 @@ static void identify_ata_device (struct ata_disk *d)
     }
   input_sector (c, id);
 
+  /* Word 47 holds the largest DRQ block size the disk supports
+     for READ/WRITE MULTIPLE in its low byte. */
+  set_multiple_mode (d, *(uint16_t *) &id[47 * 2] & 0xff);
+
+  /* Bit 8 of word 49 says whether the disk supports DMA. */
+  d->dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x0100) != 0;
+
   /* Calculate capacity.
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
-  snprintf (extra_info, sizeof extra_info, "model \"%s\", serial \"%s\"", model,
-            serial);
+  snprintf (extra_info, sizeof extra_info,
+            "model \"%s\", serial \"%s\", multiple %d, %s", model,
+            serial, d->multiple, d->dma ? "DMA" : "PIO");
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -304,6 +400,85 @@ static void identify_ata_device (struct ata_disk *d)
   partition_scan (block);
 }
 
+/* Enables READ/WRITE MULTIPLE on disk D with the largest
+   power-of-2 DRQ block size that is at most MAX_MULTIPLE and at
+   most HW_MULTIPLE, the limit the disk reported in its IDENTIFY
+   data.  Leaves D->multiple at 0, so that transfers fall back to
+   READ/WRITE SECTOR, if the disk does not support it or rejects
+   the command. */
+static void set_multiple_mode (struct ata_disk *d, int hw_multiple)
+{
+  struct channel *c = d->channel;
+  int multiple = hw_multiple < MAX_MULTIPLE ? hw_multiple : MAX_MULTIPLE;
+
+  while (multiple & (multiple - 1))
+    multiple &= multiple - 1;
+  if (multiple < 2)
+    return;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), multiple);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_alt_status (c)) & STA_ERR) == 0)
+    d->multiple = multiple;
+}
+
+/* Reads the 32-bit register REG from the configuration space of
+   PCI bus 0 device DEV function FUNC. */
+static uint32_t pci_read_config (int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes DATA to the 32-bit register REG in the configuration
+   space of PCI bus 0 device DEV function FUNC. */
+static void pci_write_config (int dev, int func, int reg, uint32_t data)
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  outl (PCI_CONFIG_DATA, data);
+}
+
+/* Looks on PCI bus 0 for an IDE controller capable of bus
+   mastering, such as the PIIX that QEMU emulates, and enables bus
+   mastering on it.  Returns the controller's bus master base I/O
+   port, or 0 if there is no such controller. */
+static uint16_t find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t class, bar4;
+
+        if ((pci_read_config (dev, func, PCI_REG_ID) & 0xffff) == 0xffff)
+          {
+            if (func == 0)
+              break;
+            continue;
+          }
+
+        /* Mass storage (01), IDE (01), bus master capable (bit 7
+           of the programming interface). */
+        class = pci_read_config (dev, func, PCI_REG_CLASS);
+        if ((class >> 16) != 0x0101 || !(class & 0x8000))
+          continue;
+
+        bar4 = pci_read_config (dev, func, PCI_REG_BAR4);
+        if (!(bar4 & 1) || (bar4 & 0xfffc) == 0)
+          continue;
+
+        pci_write_config (dev, func, PCI_REG_COMMAND,
+                          pci_read_config (dev, func, PCI_REG_COMMAND) |
+                              PCI_CMD_IO | PCI_CMD_MASTER);
+        return bar4 & 0xfffc;
+      }
+  return 0;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -331,56 +506,234 @@ static char *descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.  Uses
+   READ MULTIPLE when the disk supports it, so that the disk
+   interrupts once per DRQ block instead of once per sector.
+   Returns the number of completion interrupts taken.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
-static void ide_read (void *d_, block_sector_t sec_no, void *buffer)
+static size_t ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                                 void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+  size_t block_size = d->multiple > 0 ? d->multiple : 1;
+  uint8_t command =
+      d->multiple > 0 ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY;
+  size_t irq_cnt = 0;
+
+  if (dma_usable (d, buffer))
+    return dma_transfer (d, sec_no, cnt, buffer, false);
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%" PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      size_t nsect = cnt < MAX_NSECT ? cnt : MAX_NSECT;
+      size_t done = 0;
+
+      select_sector (d, sec_no, nsect);
+      issue_pio_command (c, command);
+      while (done < nsect)
+        {
+          size_t chunk =
+              nsect - done < block_size ? nsect - done : block_size;
+          size_t i;
+
+          sema_down (&c->completion_wait);
+          irq_cnt++;
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%" PRDSNu, d->name,
+                   sec_no + done);
+          for (i = 0; i < chunk; i++)
+            input_sector (c, buffer + (done + i) * BLOCK_SECTOR_SIZE);
+          pio_sectors += chunk;
+          done += chunk;
+        }
+      sec_no += nsect;
+      buffer += nsect * BLOCK_SECTOR_SIZE;
+      cnt -= nsect;
+    }
   lock_release (&c->lock);
+  return irq_cnt;
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Uses WRITE
+   MULTIPLE when the disk supports it.  Returns after the disk has
+   acknowledged receiving the data, with the number of completion
+   interrupts taken.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
-static void ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+static size_t ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                                  const void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+  size_t block_size = d->multiple > 0 ? d->multiple : 1;
+  uint8_t command =
+      d->multiple > 0 ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY;
+  size_t irq_cnt = 0;
+
+  if (dma_usable (d, buffer))
+    return dma_transfer (d, sec_no, cnt, (void *) buffer, true);
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%" PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      size_t nsect = cnt < MAX_NSECT ? cnt : MAX_NSECT;
+      size_t done = 0;
+
+      select_sector (d, sec_no, nsect);
+      issue_pio_command (c, command);
+      while (done < nsect)
+        {
+          size_t chunk =
+              nsect - done < block_size ? nsect - done : block_size;
+          size_t i;
+
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%" PRDSNu, d->name,
+                   sec_no + done);
+          for (i = 0; i < chunk; i++)
+            output_sector (c, buffer + (done + i) * BLOCK_SECTOR_SIZE);
+          pio_sectors += chunk;
+          sema_down (&c->completion_wait);
+          irq_cnt++;
+          done += chunk;
+        }
+      sec_no += nsect;
+      buffer += nsect * BLOCK_SECTOR_SIZE;
+      cnt -= nsect;
+    }
+  lock_release (&c->lock);
+  return irq_cnt;
+}
+
+/* Returns true if a transfer to or from BUFFER on disk D can be
+   done by DMA.  The bus master needs a physical address, so
+   BUFFER must be in kernel virtual memory, where it maps
+   linearly to physical memory, and it must be 2-byte aligned. */
+static bool dma_usable (const struct ata_disk *d, const void *buffer)
+{
+  return d->dma && is_kernel_vaddr (buffer) && ((uintptr_t) buffer & 1) == 0;
+}
+
+/* Fills channel C's PRD table to describe the CNT bytes of kernel
+   memory starting at BUFFER, splitting at 64 kB boundaries. */
+static void build_prdt (struct channel *c, void *buffer, size_t cnt)
+{
+  uintptr_t addr = vtop (buffer);
+  struct prd *prd = c->prdt;
+
+  while (cnt > 0)
+    {
+      size_t boundary_left = 0x10000 - (addr & 0xffff);
+      size_t size = cnt < boundary_left ? cnt : boundary_left;
+
+      ASSERT (prd < c->prdt + PGSIZE / sizeof *prd);
+      prd->addr = addr;
+      prd->size = size & 0xffff;
+      prd->flags = 0;
+      addr += size;
+      cnt -= size;
+      prd++;
+    }
+  prd[-1].flags = PRD_EOT;
+}
+
+/* Moves CNT sectors starting at SEC_NO between disk D and BUFFER
+   by bus-master DMA, from disk to memory unless WRITE.  The
+   calling thread sleeps on the channel's completion_wait for the
+   whole of each command, leaving the CPU to other threads.
+   Returns the number of completion interrupts taken. */
+static size_t dma_transfer (struct ata_disk *d, block_sector_t sec_no,
+                            size_t cnt, void *buffer_, bool write)
+{
+  struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+  size_t irq_cnt = 0;
+
+  lock_acquire (&c->lock);
+  while (cnt > 0)
+    {
+      size_t nsect = cnt < MAX_NSECT ? cnt : MAX_NSECT;
+      uint8_t bm_status;
+
+      build_prdt (c, buffer, nsect * BLOCK_SECTOR_SIZE);
+      outl (reg_bm_prdt (c), vtop (c->prdt));
+      outb (reg_bm_command (c), write ? 0 : BM_CMD_READ);
+      outb (reg_bm_status (c), BM_STA_ERR | BM_STA_IRQ);
+
+      select_sector (d, sec_no, nsect);
+      issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+      outb (reg_bm_command (c), (write ? 0 : BM_CMD_READ) | BM_CMD_START);
+      sema_down (&c->completion_wait);
+      irq_cnt++;
+
+      outb (reg_bm_command (c), write ? 0 : BM_CMD_READ);
+      bm_status = inb (reg_bm_status (c));
+      outb (reg_bm_status (c), BM_STA_ERR | BM_STA_IRQ);
+      if ((bm_status & BM_STA_ERR) ||
+          (inb (reg_alt_status (c)) & (STA_ERR | STA_BSY)))
+        PANIC ("%s: disk %s failed, sector=%" PRDSNu, d->name,
+               write ? "write" : "read", sec_no);
+
+      dma_cnt++;
+      dma_sectors += nsect;
+      sec_no += nsect;
+      buffer += nsect * BLOCK_SECTOR_SIZE;
+      cnt -= nsect;
+    }
   lock_release (&c->lock);
+  return irq_cnt;
+}
+
+/* Prints IDE statistics. */
+void ide_print_stats (void)
+{
+  printf ("IDE: %llu DMA commands moving %llu sectors, "
+          "%llu sectors by PIO\n",
+          dma_cnt, dma_sectors, pio_sectors);
+}
+
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void ide_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multiple (d_, sec_no, 1, buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d_, sec_no, 1, buffer);
 }
 
-static struct block_operations ide_operations = {ide_read, ide_write};
+static struct block_operations ide_operations = {
+    ide_read, ide_write, ide_read_multiple, ide_write_multiple};
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
-static void select_sector (struct ata_disk *d, block_sector_t sec_no)
+   writes SEC_NO and the transfer length CNT to the disk's sector
+   selection registers.  (We use LBA mode.) */
+static void select_sector (struct ata_disk *d, block_sector_t sec_no,
+                           size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_NSECT);
 
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_NSECT ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -1,13 +1,13 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
-#include "vm/frame.h"
 /* See [8254] for hardware details of the 8254 timer chip. */
 
 #if TIMER_FREQ < 19
@@ -20,6 +20,17 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* A thread sleeping in timer_sleep(). */
+struct sleeper
+{
+  int64_t wakeup;         /* Tick at which to wake up. */
+  struct semaphore sema;  /* Up'd by the timer interrupt. */
+  struct list_elem elem;  /* Element in sleepers. */
+};
+
+/* Sleeping threads, in order of wakeup tick. */
+static struct list sleepers;
+
 /* Number of loops perR timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
@@ -34,6 +45,7 @@ static void real_time_delay (int64_t num, int32_t denom);
    and registers the corresponding interrupt. */
 void timer_init (void)
 {
+  list_init (&sleepers);
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -78,15 +90,33 @@ int64_t timer_ticks (void)
    should be a value once returned by timer_ticks(). */
 int64_t timer_elapsed (int64_t then) { return timer_ticks () - then; }
 
+/* Returns true if sleeper A wakes up before sleeper B. */
+static bool sleeper_less (const struct list_elem *a_,
+                          const struct list_elem *b_, void *aux UNUSED)
+{
+  const struct sleeper *a = list_entry (a_, struct sleeper, elem);
+  const struct sleeper *b = list_entry (b_, struct sleeper, elem);
+  return a->wakeup < b->wakeup;
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
-   be turned on. */
+   be turned on.  The thread blocks until the timer interrupt
+   wakes it, so the CPU is free for other threads meanwhile. */
 void timer_sleep (int64_t ticks)
 {
-  int64_t start = timer_ticks ();
+  struct sleeper s;
+  enum intr_level old_level;
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks)
-    thread_yield ();
+  if (ticks <= 0)
+    return;
+
+  sema_init (&s.sema, 0);
+  old_level = intr_disable ();
+  s.wakeup = timer_ticks () + ticks;
+  list_insert_ordered (&sleepers, &s.elem, sleeper_less, NULL);
+  intr_set_level (old_level);
+  sema_down (&s.sema);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -138,8 +168,16 @@ void timer_print_stats (void)
 static void timer_interrupt (struct intr_frame *args UNUSED)
 {
   ticks++;
+  while (!list_empty (&sleepers))
+    {
+      struct sleeper *s =
+          list_entry (list_front (&sleepers), struct sleeper, elem);
+      if (s->wakeup > ticks)
+        break;
+      list_pop_front (&sleepers);
+      sema_up (&s->sema);
+    }
   thread_tick ();
-  frame_lift_fr(timer_ticks() %(10*TIMER_FREQ)==0);
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
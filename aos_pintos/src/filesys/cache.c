@@ -0,0 +1,377 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* The buffer cache holds recently used sectors of the file system
+   device in memory.  Writes stay in the cache until the sector is
+   evicted, the periodic flush runs, or the file system shuts
+   down. */
+
+/* Number of sectors in the cache. */
+#define CACHE_SIZE 64
+
+/* Ticks between write-backs of dirty sectors by the flush
+   thread. */
+#define CACHE_FLUSH_INTERVAL TIMER_FREQ
+
+/* A cached sector. */
+struct cache_entry
+{
+  struct lock lock;      /* Held while the entry is being used. */
+  block_sector_t sector; /* Sector held, if IN_USE. */
+  bool in_use;           /* Holds a sector? */
+  bool loaded;           /* DATA holds the sector's contents? */
+  bool dirty;            /* DATA newer than the disk? */
+  bool accessed;         /* Used since the clock hand last passed? */
+  bool read_ahead;       /* Read ahead and not used since? */
+  bool evicting;         /* DATA still to be written to OLD_SECTOR? */
+  block_sector_t old_sector; /* Sector held before, if EVICTING. */
+  uint8_t *data;         /* BLOCK_SECTOR_SIZE bytes. */
+};
+
+static struct cache_entry cache[CACHE_SIZE];
+
+/* Protects the SECTOR, IN_USE, EVICTING and OLD_SECTOR members
+   of every entry and the clock hand.  Those members change only
+   while both this lock and the entry's own lock are held, so
+   either one is enough to read them. */
+static struct lock cache_lock;
+static size_t clock_hand;
+
+/* Sectors waiting to be read ahead, a ring of READ_AHEAD_MAX
+   entries.  Requests that do not fit are dropped. */
+#define READ_AHEAD_MAX 64
+static block_sector_t read_ahead_queue[READ_AHEAD_MAX];
+static size_t read_ahead_head;   /* Next sector to read. */
+static size_t read_ahead_queued; /* Number of sectors queued. */
+static struct lock read_ahead_lock;
+static struct condition read_ahead_cond; /* Signaled on new sectors. */
+
+/* Statistics. */
+static unsigned long long hit_cnt;              /* Lookups found in cache. */
+static unsigned long long miss_cnt;             /* Lookups read from disk. */
+static unsigned long long writeback_cnt;        /* Dirty sectors written. */
+static unsigned long long read_ahead_cnt;       /* Sectors read ahead. */
+static unsigned long long read_ahead_hit_cnt;   /* ...and later used. */
+static unsigned long long read_ahead_waste_cnt; /* ...and evicted unused. */
+
+static void cache_flush_thread (void *aux UNUSED);
+static void cache_read_ahead_thread (void *aux UNUSED);
+
+/* Initializes the buffer cache. */
+void cache_init (void)
+{
+  uint8_t *pages;
+  size_t i;
+
+  pages = palloc_get_multiple (PAL_ASSERT,
+                               CACHE_SIZE * BLOCK_SECTOR_SIZE / PGSIZE);
+  lock_init (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      lock_init (&e->lock);
+      e->in_use = false;
+      e->loaded = false;
+      e->dirty = false;
+      e->accessed = false;
+      e->read_ahead = false;
+      e->evicting = false;
+      e->data = pages + i * BLOCK_SECTOR_SIZE;
+    }
+  clock_hand = 0;
+
+  lock_init (&read_ahead_lock);
+  cond_init (&read_ahead_cond);
+  read_ahead_head = read_ahead_queued = 0;
+}
+
+/* Starts the flush and read-ahead threads.  thread_create() opens
+   the new thread's executable, so this must wait until the rest
+   of the file system is initialized. */
+void cache_start (void)
+{
+  thread_create ("cache-flush", PRI_DEFAULT, cache_flush_thread, NULL);
+  thread_create ("cache-readahead", PRI_DEFAULT, cache_read_ahead_thread,
+                 NULL);
+}
+
+/* Writes entry E back to disk if it is dirty.  E's lock must be
+   held. */
+static void cache_writeback (struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&e->lock));
+  if (e->in_use && e->dirty)
+    {
+      block_write (fs_device, e->sector, e->data);
+      e->dirty = false;
+      writeback_cnt++;
+    }
+}
+
+/* Chooses an entry to hold a new sector with the clock
+   algorithm, skipping entries that are in use by other threads,
+   and returns it locked.  A dirty victim is marked EVICTING, for
+   the caller to write back once it has released cache_lock.
+   cache_lock must be held.
+
+   If every entry is in use, waits for the one under the clock
+   hand instead of spinning.  That means releasing cache_lock, so
+   in that case it returns a null pointer, with cache_lock
+   released, and the caller must look its sector up again. */
+static struct cache_entry *cache_evict (void)
+{
+  struct cache_entry *e;
+  size_t tries;
+
+  /* Two sweeps: the first may only clear accessed bits. */
+  for (tries = 0; tries < 2 * CACHE_SIZE; tries++)
+    {
+      e = &cache[clock_hand];
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+      if (!lock_try_acquire (&e->lock))
+        continue;
+      if (!e->in_use)
+        return e;
+      if (e->accessed)
+        {
+          e->accessed = false;
+          lock_release (&e->lock);
+          continue;
+        }
+
+      if (e->read_ahead)
+        read_ahead_waste_cnt++;
+      if (e->dirty)
+        {
+          /* Lookups of the old sector keep finding this entry, and
+             so wait on its lock, until its contents are on
+             disk. */
+          e->evicting = true;
+          e->old_sector = e->sector;
+          e->dirty = false;
+          writeback_cnt++;
+        }
+      e->in_use = false;
+      return e;
+    }
+
+  e = &cache[clock_hand];
+  clock_hand = (clock_hand + 1) % CACHE_SIZE;
+  lock_release (&cache_lock);
+  lock_acquire (&e->lock);
+  lock_release (&e->lock);
+  return NULL;
+}
+
+/* Returns true if entry E holds SECTOR or is still writing
+   SECTOR back.  cache_lock or E's lock must be held. */
+static bool cache_holds (struct cache_entry *e, block_sector_t sector)
+{
+  return (e->in_use && e->sector == sector)
+         || (e->evicting && e->old_sector == sector);
+}
+
+/* Returns the entry for SECTOR, locked, bringing the sector into
+   the cache first if necessary.  If LOAD is false, the caller is
+   about to overwrite the whole sector, so its old contents need
+   not be read from disk.  If READ_AHEAD is true, the sector is
+   wanted only by the read-ahead thread: returns a null pointer if
+   it is already cached and otherwise marks it as read ahead. */
+static struct cache_entry *cache_get (block_sector_t sector, bool load,
+                                      bool read_ahead)
+{
+  struct cache_entry *e;
+  size_t i;
+
+  for (;;)
+    {
+      lock_acquire (&cache_lock);
+      for (i = 0; i < CACHE_SIZE; i++)
+        if (cache_holds (&cache[i], sector))
+          break;
+      if (i == CACHE_SIZE)
+        {
+          e = cache_evict ();
+          if (e != NULL)
+            break;
+          continue;
+        }
+
+      /* Found it.  Wait for whoever is using it, then make sure it
+         was not evicted meanwhile. */
+      e = &cache[i];
+      lock_release (&cache_lock);
+      lock_acquire (&e->lock);
+      if (e->in_use && e->sector == sector)
+        {
+          if (read_ahead)
+            {
+              lock_release (&e->lock);
+              return NULL;
+            }
+          hit_cnt++;
+          if (e->read_ahead)
+            {
+              e->read_ahead = false;
+              read_ahead_hit_cnt++;
+            }
+          goto found;
+        }
+      lock_release (&e->lock);
+    }
+
+  /* Not cached.  Claim the entry, then write back its old sector
+     and read the new one in without holding cache_lock; anyone
+     else who wants either sector waits on its lock. */
+  e->sector = sector;
+  e->in_use = true;
+  e->loaded = false;
+  e->dirty = false;
+  e->read_ahead = read_ahead;
+  if (read_ahead)
+    read_ahead_cnt++;
+  else
+    miss_cnt++;
+  lock_release (&cache_lock);
+
+  if (e->evicting)
+    {
+      block_write (fs_device, e->old_sector, e->data);
+      lock_acquire (&cache_lock);
+      e->evicting = false;
+      lock_release (&cache_lock);
+    }
+
+found:
+  if (load && !e->loaded)
+    {
+      block_read (fs_device, sector, e->data);
+      e->loaded = true;
+    }
+  e->accessed = true;
+  return e;
+}
+
+/* Reads SIZE bytes starting at byte OFS within SECTOR into
+   BUFFER. */
+void cache_read_at (block_sector_t sector, void *buffer, off_t ofs,
+                    size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true, false);
+  memcpy (buffer, e->data + ofs, size);
+  lock_release (&e->lock);
+}
+
+/* Reads SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER to SECTOR starting at byte OFS
+   within the sector.  The data reaches the disk later. */
+void cache_write_at (block_sector_t sector, const void *buffer, off_t ofs,
+                     size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE, false);
+  memcpy (e->data + ofs, buffer, size);
+  e->loaded = true;
+  e->dirty = true;
+  lock_release (&e->lock);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to SECTOR.  The data
+   reaches the disk later. */
+void cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Queues SECTOR to be brought into the cache in the background.
+   Does nothing if the queue is full. */
+void cache_read_ahead (block_sector_t sector)
+{
+  lock_acquire (&read_ahead_lock);
+  if (read_ahead_queued < READ_AHEAD_MAX)
+    {
+      read_ahead_queue[(read_ahead_head + read_ahead_queued++) %
+                       READ_AHEAD_MAX] = sector;
+      cond_signal (&read_ahead_cond, &read_ahead_lock);
+    }
+  lock_release (&read_ahead_lock);
+}
+
+/* Read-ahead thread.  Reads queued sectors into the cache. */
+static void cache_read_ahead_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct cache_entry *e;
+      block_sector_t sector;
+
+      lock_acquire (&read_ahead_lock);
+      while (read_ahead_queued == 0)
+        cond_wait (&read_ahead_cond, &read_ahead_lock);
+      sector = read_ahead_queue[read_ahead_head];
+      read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_MAX;
+      read_ahead_queued--;
+      lock_release (&read_ahead_lock);
+
+      e = cache_get (sector, true, true);
+      if (e != NULL)
+        lock_release (&e->lock);
+    }
+}
+
+/* Writes every dirty sector in the cache back to disk. */
+void cache_flush (void)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+      lock_acquire (&e->lock);
+      cache_writeback (e);
+      lock_release (&e->lock);
+    }
+}
+
+/* Flush thread.  Writes dirty sectors back every
+   CACHE_FLUSH_INTERVAL ticks, so that not much is lost on a
+   crash. */
+static void cache_flush_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (CACHE_FLUSH_INTERVAL);
+      cache_flush ();
+    }
+}
+
+/* Prints buffer cache statistics. */
+void cache_print_stats (void)
+{
+  printf ("Cache: %llu hits, %llu misses, %llu write-backs\n", hit_cnt,
+          miss_cnt, writeback_cnt);
+  printf ("Cache: %llu sectors read ahead, %llu used, %llu wasted\n",
+          read_ahead_cnt, read_ahead_hit_cnt, read_ahead_waste_cnt);
+}
@@ -3,6 +3,13 @@
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 #include "filesys/directory.h"
+#include "devices/block.h"
+
+/* Read-ahead window bounds, in sectors.  The window starts at
+   RA_MIN_WINDOW on the first sequential read and doubles on each
+   sequential read after that, up to RA_MAX_WINDOW. */
+#define RA_MIN_WINDOW 2
+#define RA_MAX_WINDOW 32
 
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
@@ -15,6 +22,9 @@ struct file *file_open (struct inode *inode)
       file->inode = inode;
       file->pos = 0;
       file->deny_write = false;
+      file->ra_next = 0;
+      file->ra_end = 0;
+      file->ra_window = 0;
       return file;
     }
   else
@@ -53,8 +63,38 @@ struct inode *file_get_inode (struct file *file) { return file->inode; }
    Advances FILE's position by the number of bytes read. */
 off_t file_read (struct file *file, void *buffer, off_t size)
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read;
+
+  /* A read that picks up where the last one left off is
+     sequential and widens the read-ahead window; anything else
+     collapses it. */
+  if (file->pos == file->ra_next)
+    file->ra_window = file->ra_window == 0 ? RA_MIN_WINDOW
+                      : file->ra_window * 2 > RA_MAX_WINDOW
+                          ? RA_MAX_WINDOW
+                          : file->ra_window * 2;
+  else
+    {
+      file->ra_window = 0;
+      file->ra_end = 0;
+    }
+
+  bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
+  file->ra_next = file->pos;
+
+  /* Queue the sectors ahead of the new position that have not
+     been read ahead yet. */
+  if (file->ra_window > 0)
+    {
+      off_t start = file->ra_end > file->pos ? file->ra_end : file->pos;
+      off_t end = file->pos + file->ra_window * BLOCK_SECTOR_SIZE;
+      if (start < end)
+        {
+          inode_read_ahead (file->inode, start, end - start);
+          file->ra_end = end;
+        }
+    }
   return bytes_read;
 }
 
@@ -71,9 +111,8 @@ off_t file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file grows the file.
    Advances FILE's position by the number of bytes read. */
 off_t file_write (struct file *file, const void *buffer, off_t size)
 {
@@ -85,9 +124,8 @@ off_t file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file grows the file.
    The file's current position is unaffected. */
 off_t file_write_at (struct file *file, const void *buffer, off_t size,
                      off_t file_ofs)
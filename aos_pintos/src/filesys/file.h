@@ -1,6 +1,7 @@
 #ifndef FILESYS_FILE_H
 #define FILESYS_FILE_H
 
+#include <stddef.h>
 #include "filesys/off_t.h"
 #include "lib/stdbool.h"
 
@@ -12,6 +13,11 @@ struct file
   struct inode *inode; /* File's inode. */
   off_t pos;           /* Current position. */
   bool deny_write;     /* Has file_deny_write() been called? */
+
+  /* Sequential read-ahead. */
+  off_t ra_next;       /* Position a sequential read would start at. */
+  off_t ra_end;        /* End of the range already read ahead. */
+  size_t ra_window;    /* Sectors to keep read ahead, 0 if random. */
 };
 
 /* Opening and closing files. */
@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
@@ -20,6 +21,7 @@ void filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
   free_map_init ();
 
@@ -27,11 +29,16 @@ void filesys_init (bool format)
     do_format ();
 
   free_map_open ();
+  cache_start ();
 }
 
 /* Shuts down the file system module, writing any unwritten data
    to disk. */
-void filesys_done (void) { free_map_close (); }
+void filesys_done (void)
+{
+  free_map_close ();
+  cache_flush ();
+}
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
    Returns true if successful, false otherwise.
@@ -1,12 +1,15 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include "threads/synch.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 
 static struct file *free_map_file; /* Free map file. */
 static struct bitmap *free_map;    /* Free map, one bit per sector. */
+static bool free_map_dirty;        /* Changed since last written? */
+static struct lock free_map_lock;  /* Protects FREE_MAP and FREE_MAP_DIRTY. */
 
 /* Initializes the free map. */
 void free_map_init (void)
@@ -14,6 +17,7 @@ void free_map_init (void)
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  lock_init (&free_map_lock);
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
 }
@@ -21,28 +25,33 @@ void free_map_init (void)
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.
+   The free map file is written back only when it is closed, not
+   on every allocation: inode sectors are allocated while writing
+   files, the free map file included.
+   Safe to call without the file system lock, so that pages of
+   mapped files can be written back from the eviction path. */
 bool free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
+  lock_acquire (&free_map_lock);
   block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR && free_map_file != NULL &&
-      !bitmap_write (free_map, free_map_file))
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false);
-      sector = BITMAP_ERROR;
+      *sectorp = sector;
+      free_map_dirty = true;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+  lock_release (&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  free_map_dirty = true;
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -56,7 +65,12 @@ void free_map_open (void)
 }
 
 /* Writes the free map to disk and closes the free map file. */
-void free_map_close (void) { file_close (free_map_file); }
+void free_map_close (void)
+{
+  if (free_map_dirty && !bitmap_write (free_map, free_map_file))
+    PANIC ("can't write free map");
+  file_close (free_map_file);
+}
 
 /* Creates a new free map file on disk and writes the free map to
    it. */
@@ -66,10 +80,14 @@ void free_map_create (void)
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
+  /* Write bitmap to file.  The first write allocates the file's
+     data sectors, which changes the bitmap as it is written, so
+     write it again to get the final state on disk. */
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  if (!bitmap_write (free_map, free_map_file)
+      || !bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  free_map_dirty = false;
 }
@@ -3,30 +3,48 @@
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of direct sector pointers in an inode. */
+#define INODE_DIRECT_CNT 123
+
+/* Number of sector pointers in an indirect block. */
+#define INODE_PTRS_PER_BLOCK (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Number of data sectors reachable from an inode: direct,
+   then indirect, then doubly indirect.  About 8 MB. */
+#define INODE_MAX_SECTORS                                                 \
+  (INODE_DIRECT_CNT + INODE_PTRS_PER_BLOCK +                              \
+   INODE_PTRS_PER_BLOCK * INODE_PTRS_PER_BLOCK)
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   A sector pointer of 0 means no sector is allocated there yet;
+   sector 0 holds the free map inode, so it is never file data.
+   Unallocated data sectors read as zeros. */
 struct inode_disk
 {
-  block_sector_t start; /* First data sector. */
-  off_t length;         /* File size in bytes. */
-  unsigned magic;       /* Magic number. */
-  bool is_symlink;      /* True if symbolic link, false otherwise. */
-  uint32_t unused[124]; /* Not used. */
+  block_sector_t direct[INODE_DIRECT_CNT]; /* Data sectors. */
+  block_sector_t indirect;        /* Block of data sector pointers. */
+  block_sector_t doubly_indirect; /* Block of indirect block pointers. */
+  off_t length;                   /* File size in bytes. */
+  unsigned magic;                 /* Magic number. */
+  bool is_symlink;   /* True if symbolic link, false otherwise. */
+  uint8_t unused[3]; /* Not used. */
 };
 
-/* Returns the number of sectors to allocate for an inode SIZE
-   bytes long. */
-static inline size_t bytes_to_sectors (off_t size)
-{
-  return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
-}
+/* Levels of indirect blocks cached in a struct inode: the
+   indirect or doubly indirect block itself, and the indirect
+   block below the doubly indirect one. */
+#define INODE_INDEX_LEVELS 2
 
 /* In-memory inode. */
 struct inode
@@ -36,20 +54,165 @@ struct inode
   int open_cnt;           /* Number of openers. */
   bool removed;           /* True if deleted, false otherwise. */
   int deny_write_cnt;     /* 0: writes ok, >0: deny writes. */
+  struct lock lock;       /* Protects DATA and the index cache. */
   struct inode_disk data; /* Inode content. */
+
+  /* Most recently used indirect block at each level, so that
+     sequential lookups do not go back to the buffer cache. */
+  block_sector_t index_sector[INODE_INDEX_LEVELS]; /* 0 if none. */
+  block_sector_t index[INODE_INDEX_LEVELS][INODE_PTRS_PER_BLOCK];
 };
 
+/* Allocates a sector, fills it with zeros, and stores it in
+   *SECTORP.  Returns true if successful, false if the disk is
+   full. */
+static bool allocate_zeroed (block_sector_t *sectorp)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+
+  if (!free_map_allocate (1, sectorp))
+    return false;
+  cache_write (*sectorp, zeros);
+  return true;
+}
+
+/* Returns the contents of indirect block SECTOR at index cache
+   LEVEL of INODE, reading it in if it is not the one cached. */
+static block_sector_t *index_load (struct inode *inode, int level,
+                                   block_sector_t sector)
+{
+  if (inode->index_sector[level] != sector)
+    {
+      cache_read (sector, inode->index[level]);
+      inode->index_sector[level] = sector;
+    }
+  return inode->index[level];
+}
+
+/* Returns entry IDX of indirect block SECTOR, using index cache
+   LEVEL of INODE.  If the entry is 0 and CREATE is true, first
+   allocates a zeroed sector for it.  Returns 0 if there is no
+   sector there or allocation fails. */
+static block_sector_t index_get (struct inode *inode, int level,
+                                 block_sector_t sector, size_t idx,
+                                 bool create)
+{
+  block_sector_t *index = index_load (inode, level, sector);
+
+  if (index[idx] == 0 && create)
+    {
+      block_sector_t new_sector;
+
+      if (!allocate_zeroed (&new_sector))
+        return 0;
+      index[idx] = new_sector;
+      cache_write_at (sector, &new_sector, idx * sizeof new_sector,
+                      sizeof new_sector);
+    }
+  return index[idx];
+}
+
+/* Returns the sector in INODE's own pointer *SLOT.  If it is 0
+   and CREATE is true, first allocates a zeroed sector for it and
+   writes the inode back.  Returns 0 if there is no sector there
+   or allocation fails. */
+static block_sector_t slot_get (struct inode *inode, block_sector_t *slot,
+                                bool create)
+{
+  if (*slot == 0 && create)
+    {
+      if (!allocate_zeroed (slot))
+        return 0;
+      cache_write (inode->sector, &inode->data);
+    }
+  return *slot;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
-static block_sector_t byte_to_sector (const struct inode *inode, off_t pos)
+   within INODE.  If no sector has been allocated for POS yet,
+   allocates one if CREATE is true.  Returns 0 if there is no
+   sector for POS, if POS is beyond the largest file size, or if
+   allocation fails.  INODE's lock must be held. */
+static block_sector_t byte_to_sector (struct inode *inode, off_t pos,
+                                      bool create)
 {
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  block_sector_t block;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
-    return -1;
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+
+  if (idx < INODE_DIRECT_CNT)
+    return slot_get (inode, &inode->data.direct[idx], create);
+  idx -= INODE_DIRECT_CNT;
+
+  if (idx < INODE_PTRS_PER_BLOCK)
+    {
+      block = slot_get (inode, &inode->data.indirect, create);
+      return block != 0 ? index_get (inode, 0, block, idx, create) : 0;
+    }
+  idx -= INODE_PTRS_PER_BLOCK;
+
+  if (idx < INODE_PTRS_PER_BLOCK * INODE_PTRS_PER_BLOCK)
+    {
+      block = slot_get (inode, &inode->data.doubly_indirect, create);
+      if (block != 0)
+        block = index_get (inode, 0, block, idx / INODE_PTRS_PER_BLOCK,
+                           create);
+      return block != 0 ? index_get (inode, 1, block,
+                                     idx % INODE_PTRS_PER_BLOCK, create)
+                        : 0;
+    }
+  return 0;
+}
+
+/* Returns the sector that contains byte offset POS within INODE,
+   or 0 if none is allocated, taking INODE's lock. */
+static block_sector_t lookup_sector (struct inode *inode, off_t pos)
+{
+  block_sector_t sector;
+
+  lock_acquire (&inode->lock);
+  sector = byte_to_sector (inode, pos, false);
+  lock_release (&inode->lock);
+  return sector;
+}
+
+/* Releases indirect block SECTOR and, if DEPTH is greater than 1,
+   the indirect blocks it points to, along with all the data
+   sectors below them. */
+static void release_index (block_sector_t sector, int depth)
+{
+  block_sector_t *index = malloc (BLOCK_SECTOR_SIZE);
+  size_t i;
+
+  if (index == NULL)
+    PANIC ("out of memory releasing inode blocks");
+  cache_read (sector, index);
+  for (i = 0; i < INODE_PTRS_PER_BLOCK; i++)
+    if (index[i] != 0)
+      {
+        if (depth > 1)
+          release_index (index[i], depth - 1);
+        else
+          free_map_release (index[i], 1);
+      }
+  free (index);
+  free_map_release (sector, 1);
+}
+
+/* Releases all of the sectors allocated to INODE's data. */
+static void release_data (struct inode *inode)
+{
+  size_t i;
+
+  for (i = 0; i < INODE_DIRECT_CNT; i++)
+    if (inode->data.direct[i] != 0)
+      free_map_release (inode->data.direct[i], 1);
+  if (inode->data.indirect != 0)
+    release_index (inode->data.indirect, 1);
+  if (inode->data.doubly_indirect != 0)
+    release_index (inode->data.doubly_indirect, 2);
 }
 
 /* List of open inodes, so that opening a single inode twice
@@ -61,9 +224,11 @@ void inode_init (void) { list_init (&open_inodes); }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  Data sectors are allocated only when first written,
+   so until then the file reads as zeros.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails or LENGTH is larger
+   than the largest file an inode can describe. */
 bool inode_create (block_sector_t sector, off_t length)
 {
   struct inode_disk *disk_inode = NULL;
@@ -75,26 +240,17 @@ bool inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  if ((size_t) DIV_ROUND_UP (length, BLOCK_SECTOR_SIZE) > INODE_MAX_SECTORS)
+    return false;
+
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
       disk_inode->is_symlink = false;
-      if (free_map_allocate (sectors, &disk_inode->start))
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0)
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-
-              for (i = 0; i < sectors; i++)
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true;
-        }
+      cache_write (sector, disk_inode);
+      success = true;
       free (disk_inode);
     }
   return success;
@@ -131,7 +287,9 @@ struct inode *inode_open (block_sector_t sector)
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  lock_init (&inode->lock);
+  inode->index_sector[0] = inode->index_sector[1] = 0;
+  cache_read (inode->sector, &inode->data);
   return inode;
 }
 
@@ -167,9 +325,8 @@ void inode_close (struct inode *inode)
       /* Deallocate blocks if removed. */
       if (inode->removed)
         {
+          release_data (inode);
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length));
         }
 
       free (inode);
@@ -197,7 +354,7 @@ off_t inode_read_at (struct inode *inode, void *buffer_, off_t size,
   while (size > 0)
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = lookup_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -210,23 +367,30 @@ off_t inode_read_at (struct inode *inode, void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (sector_idx == 0)
+        {
+          /* Nothing written here yet. */
+          memset (buffer + bytes_read, 0, chunk_size);
+        }
+      else if (is_kernel_vaddr (buffer))
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
+          /* Copy straight out of the buffer cache. */
+          cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                         chunk_size);
         }
       else
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
+          /* Copy into bounce buffer, then into caller's buffer, so
+             that a page fault on the user buffer does not happen
+             while a cache entry is locked. */
           if (bounce == NULL)
             {
               bounce = malloc (BLOCK_SECTOR_SIZE);
               if (bounce == NULL)
                 break;
             }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          cache_read_at (sector_idx, bounce, sector_ofs, chunk_size);
+          memcpy (buffer + bytes_read, bounce, chunk_size);
         }
 
       /* Advance. */
@@ -239,11 +403,30 @@ off_t inode_read_at (struct inode *inode, void *buffer_, off_t size,
   return bytes_read;
 }
 
+/* Asks the buffer cache to bring the sectors of INODE that hold
+   the SIZE bytes starting at OFFSET into memory in the
+   background.  Bytes past the end of INODE are ignored. */
+void inode_read_ahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (offset -= offset % BLOCK_SECTOR_SIZE; offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = lookup_sector (inode, offset);
+      if (sector != 0)
+        cache_read_ahead (sector);
+    }
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or the file reaches the
+   largest size an inode can describe.  Writing past end of file
+   extends it; any gap before OFFSET stays unallocated and reads
+   as zeros. */
 off_t inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                       off_t offset)
 {
@@ -257,43 +440,38 @@ off_t inode_write_at (struct inode *inode, const void *buffer_, off_t size,
   while (size > 0)
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Number of bytes to actually write into this sector. */
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      int chunk_size = size < sector_left ? size : sector_left;
 
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      lock_acquire (&inode->lock);
+      sector_idx = byte_to_sector (inode, offset, true);
+      lock_release (&inode->lock);
+      if (sector_idx == 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (is_kernel_vaddr (buffer))
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          /* Copy straight into the buffer cache, which reads the
+             rest of the sector in first if the chunk does not
+             cover it all. */
+          cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                          chunk_size);
         }
       else
         {
-          /* We need a bounce buffer. */
+          /* Go through a bounce buffer, as in inode_read_at(). */
           if (bounce == NULL)
             {
               bounce = malloc (BLOCK_SECTOR_SIZE);
               if (bounce == NULL)
                 break;
             }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left)
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          memcpy (bounce, buffer + bytes_written, chunk_size);
+          cache_write_at (sector_idx, bounce, sector_ofs, chunk_size);
         }
 
       /* Advance. */
@@ -303,6 +481,16 @@ off_t inode_write_at (struct inode *inode, const void *buffer_, off_t size,
     }
   free (bounce);
 
+  /* Extend the file only now that the data is in place, so that
+     readers never see the new length before the new bytes. */
+  lock_acquire (&inode->lock);
+  if (offset > inode->data.length)
+    {
+      inode->data.length = offset;
+      cache_write (inode->sector, &inode->data);
+    }
+  lock_release (&inode->lock);
+
   return bytes_written;
 }
 
@@ -334,6 +522,8 @@ bool inode_get_symlink (struct inode *inode) {
 
 void inode_set_symlink (struct inode *inode, bool is_symlink)
 {
+  lock_acquire (&inode->lock);
   inode->data.is_symlink = is_symlink;
-  block_write (fs_device, inode->sector, &inode->data);
+  cache_write (inode->sector, &inode->data);
+  lock_release (&inode->lock);
 }
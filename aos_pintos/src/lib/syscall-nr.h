@@ -20,7 +20,7 @@ enum
   SYS_CLOSE,    /* Close a file. */
   SYS_SYMLINK,  /* Create soft link */
 
-  /* Not needed in UTCS Pintos project */
+  /* Project 3 and optionally project 4. */
   SYS_MMAP,   /* Map a file into memory. */
   SYS_MUNMAP, /* Remove a memory mapping. */
 
@@ -30,7 +30,10 @@ enum
   SYS_READDIR, /* Reads a directory entry. */
   SYS_ISDIR,   /* Tests if a fd represents a directory. */
   SYS_INUMBER, /* Returns the inode number for a fd. */
-  SYS_STAT  /* Returns information about a file */
+  SYS_STAT,  /* Returns information about a file */
+
+  /* Extensions. */
+  SYS_FORK   /* Clone this process copy-on-write. */
 };
 
 #endif /* lib/syscall-nr.h */
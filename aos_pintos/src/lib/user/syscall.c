@@ -66,6 +66,8 @@ void exit (int status)
 
 pid_t exec (const char *file) { return (pid_t) syscall1 (SYS_EXEC, file); }
 
+pid_t fork (void) { return (pid_t) syscall0 (SYS_FORK); }
+
 int wait (pid_t pid) { return syscall1 (SYS_WAIT, pid); }
 
 bool create (const char *file, unsigned initial_size)
@@ -100,6 +102,10 @@ int symlink (char *target, char *linkpath)
   return syscall2 (SYS_SYMLINK, target, linkpath);
 }
 
+mapid_t mmap (int fd, void *addr) { return syscall2 (SYS_MMAP, fd, addr); }
+
+void munmap (mapid_t mapid) { syscall1 (SYS_MUNMAP, mapid); }
+
 bool chdir (const char *dir) { return syscall1 (SYS_CHDIR, dir); }
 
 bool mkdir (const char *dir) { return syscall1 (SYS_MKDIR, dir); }
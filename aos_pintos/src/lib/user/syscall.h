@@ -8,7 +8,7 @@
 typedef int pid_t;
 #define PID_ERROR ((pid_t) -1)
 
-/* Map region identifier. Not needed in UTCS Pintos Projects */
+/* Map region identifier. */
 typedef int mapid_t;
 #define MAP_FAILED ((mapid_t) -1)
 
@@ -23,6 +23,7 @@ typedef int mapid_t;
 void halt (void) NO_RETURN;
 void exit (int status) NO_RETURN;
 pid_t exec (const char *file);
+pid_t fork (void);
 int wait (pid_t);
 bool create (const char *file, unsigned initial_size);
 bool remove (const char *file);
@@ -34,6 +35,8 @@ void seek (int fd, unsigned position);
 unsigned tell (int fd);
 void close (int fd);
 int symlink (char *target, char *linkpath);
+mapid_t mmap (int fd, void *addr);
+void munmap (mapid_t);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
@@ -0,0 +1,33 @@
+/* Child process of page-par-fault.
+   Stamps every page of 1 MB with a value derived from its
+   index and the child's argument, then reads all the stamps
+   back several times, faulting each page in again on every
+   pass once the children together outgrow the user pool. */
+
+#include <stdlib.h>
+#include "tests/lib.h"
+
+#define SIZE (1024 * 1024)
+#define PAGE 4096
+#define READ_PASSES 3
+
+static char buf[SIZE];
+
+int main (int argc, char *argv[])
+{
+  int seed = atoi (argv[argc - 1]);
+  size_t i;
+  int pass;
+
+  test_name = "child-fault";
+
+  for (i = 0; i < SIZE; i += PAGE)
+    buf[i] = (char) (i / PAGE * 7 + seed);
+
+  for (pass = 0; pass < READ_PASSES; pass++)
+    for (i = 0; i < SIZE; i += PAGE)
+      if (buf[i] != (char) (i / PAGE * 7 + seed))
+        fail ("pass %d: page %zu has the wrong stamp", pass, i / PAGE);
+
+  return 0x42;
+}
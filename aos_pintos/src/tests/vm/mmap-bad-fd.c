@@ -0,0 +1,15 @@
+/* Tries to mmap an invalid fd and the console, which must fail
+   without terminating the process. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void test_main (void)
+{
+  CHECK (mmap (0x5678, (void *) 0x10000000) == MAP_FAILED,
+         "try to mmap invalid fd");
+  CHECK (mmap (STDOUT_FILENO, (void *) 0x10000000) == MAP_FAILED,
+         "try to mmap the console");
+}
@@ -0,0 +1,20 @@
+/* Tries to map a zero-length file, which must fail without
+   terminating the process.  Then dereferences the address that
+   we tried to map, and the process must be terminated with -1
+   exit code. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void test_main (void)
+{
+  char *data = (char *) 0x7f000000;
+  int handle;
+
+  CHECK (create ("empty", 0), "create empty file \"empty\"");
+  CHECK ((handle = open ("empty")) > 1, "open \"empty\"");
+  CHECK (mmap (handle, data) == MAP_FAILED, "try to mmap empty file");
+
+  fail ("unmapped memory is readable (%d)", *data);
+}
@@ -0,0 +1,70 @@
+/* Forks and checks that the parent and the child keep separate
+   copies of memory that both write after the fork, and separate
+   positions in a file that was open before it.
+
+   The child writes first, while the parent still maps the shared
+   frames, so its writes copy them.  The parent writes after the
+   child has exited, as the last owner of each frame, so its
+   writes just get the frames back writable. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHUNK 64
+
+static char buf[4 * 4096];
+
+/* Fails unless every byte of buf is VALUE. */
+static void check_buf (const char *who, char value)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != value)
+      fail ("%s: byte %zu is %02hhx instead of %02hhx", who, i, buf[i],
+            value);
+}
+
+/* Reads the next CHUNK bytes of HANDLE and fails unless they are
+   the bytes of sample.txt at OFS. */
+static void check_read (const char *who, int handle, size_t ofs)
+{
+  char data[CHUNK];
+
+  if (read (handle, data, CHUNK) != CHUNK
+      || memcmp (data, sample + ofs, CHUNK))
+    fail ("%s: wrong data read at offset %zu", who, ofs);
+}
+
+void test_main (void)
+{
+  char data[CHUNK];
+  int handle;
+  pid_t child;
+
+  memset (buf, 'p', sizeof buf);
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (read (handle, data, CHUNK) == CHUNK, "read %d bytes", CHUNK);
+
+  child = fork ();
+  if (child == 0)
+    {
+      check_buf ("child", 'p');
+      check_read ("child", handle, CHUNK);
+      memset (buf, 'c', sizeof buf);
+      check_buf ("child", 'c');
+      exit (0x42);
+    }
+  CHECK (child != -1, "fork");
+  CHECK (wait (child) == 0x42, "wait for child");
+
+  /* The child's writes and reads must not show here. */
+  check_buf ("parent", 'p');
+  check_read ("parent", handle, CHUNK);
+  memset (buf, 'q', sizeof buf);
+  check_buf ("parent", 'q');
+  close (handle);
+}
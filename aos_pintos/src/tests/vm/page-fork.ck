@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-fork) begin
+(page-fork) open "sample.txt"
+(page-fork) read 64 bytes
+(page-fork) fork
+(page-fork) wait for child
+(page-fork) end
+EOF
+pass;
@@ -0,0 +1,31 @@
+/* Scans 8 MB of zero-initialized memory linearly, writing and then
+   reading it back, so that a kernel run with -lp can back the 4 MB
+   aligned part of it with a large page.  Compare the page fault
+   count and user ticks printed at shutdown with and without -lp. */
+
+#include <string.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (8 * 1024 * 1024)
+
+static char buf[SIZE];
+
+void test_main (void)
+{
+  size_t i;
+
+  msg ("zero pass");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != 0)
+      fail ("byte %zu != 0", i);
+
+  msg ("write pass");
+  for (i = 0; i < SIZE; i++)
+    buf[i] = i % 251;
+
+  msg ("read pass");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != (char) (i % 251))
+      fail ("byte %zu != %d", i, (int) (i % 251));
+}
@@ -0,0 +1,27 @@
+/* Runs 4 child-fault processes at once, so that they keep
+   faulting and evicting each other's pages concurrently.
+
+   This is a throughput benchmark as much as a test: the
+   "Timer" ticks and the count of faults that evicted
+   synchronously, printed at power off, show how well page
+   faults of different processes overlap with swap I/O. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 4
+
+void test_main (void)
+{
+  static const char *cmds[CHILD_CNT] = {"child-fault 0", "child-fault 1",
+                                        "child-fault 2", "child-fault 3"};
+  pid_t children[CHILD_CNT];
+  int i;
+
+  for (i = 0; i < CHILD_CNT; i++)
+    CHECK ((children[i] = exec (cmds[i])) != -1, "exec \"%s\"", cmds[i]);
+
+  for (i = 0; i < CHILD_CNT; i++)
+    CHECK (wait (children[i]) == 0x42, "wait for child %d", i);
+}
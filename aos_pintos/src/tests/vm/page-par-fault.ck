@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-par-fault) begin
+(page-par-fault) exec "child-fault 0"
+(page-par-fault) exec "child-fault 1"
+(page-par-fault) exec "child-fault 2"
+(page-par-fault) exec "child-fault 3"
+(page-par-fault) wait for child 0
+(page-par-fault) wait for child 1
+(page-par-fault) wait for child 2
+(page-par-fault) wait for child 3
+(page-par-fault) end
+EOF
+pass;
@@ -37,6 +37,10 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#endif
 
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -122,6 +126,7 @@ int main (void)
   ide_init ();
   locate_block_devices ();
   filesys_init (format_filesys);
+  block_start_queues ();
 #endif
 #ifdef VM
   page_init();
@@ -185,6 +190,12 @@ static void paging_init (void)
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
   asm volatile("movl %0, %%cr3" : : "r"(vtop (init_page_dir)));
+
+  /* Let page directory entries map 4 MB pages.  Only user page
+     directories get such entries, see pagedir_set_large_page().
+     See [IA32-v3a] 3.7.3 "Mixing 4-KByte and 4-MByte Pages". */
+  asm volatile("movl %%cr4, %%eax; orl $0x10, %%eax; movl %%eax, %%cr4"
+               : : : "eax");
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -244,6 +255,8 @@ static char **parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-pio"))
+        ide_pio_only = true;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -256,6 +269,18 @@ static char **parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-lowat"))
+        frame_low_watermark = atoi (value);
+      else if (!strcmp (name, "-hiwat"))
+        frame_high_watermark = atoi (value);
+      else if (!strcmp (name, "-fa"))
+        page_fault_around = atoi (value);
+      else if (!strcmp (name, "-pff"))
+        frame_pff_interval = atoi (value);
+      else if (!strcmp (name, "-lp"))
+        page_large = true;
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -365,6 +390,7 @@ static void usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -pio               Use PIO for IDE disks even if DMA works.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -373,6 +399,14 @@ static void usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -lowat=COUNT       Start paging out below COUNT free user pages.\n"
+          "  -hiwat=COUNT       Stop paging out at COUNT free user pages.\n"
+          "  -fa=COUNT          Map up to COUNT following pages on a fault.\n"
+          "  -pff=COUNT         Grow a process's frame allowance if it faults\n"
+          "                     within COUNT faults of its last, 0 for no limits.\n"
+          "  -lp                Map zero-filled 4 MB regions with 4 MB pages.\n"
 #endif
   );
   shutdown_power_off ();
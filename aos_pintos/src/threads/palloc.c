@@ -7,6 +7,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -31,6 +32,8 @@ struct pool
   struct lock lock;        /* Mutual exclusion. */
   struct bitmap *used_map; /* Bitmap of free pages. */
   uint8_t *base;           /* Base of pool. */
+  size_t free_cnt;         /* Number of free pages, see
+                              pool_adjust_free(). */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -39,6 +42,8 @@ static struct pool kernel_pool, user_pool;
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t scan_aligned (struct pool *, size_t page_cnt, size_t align);
+static void pool_adjust_free (struct pool *, int delta);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -67,17 +72,28 @@ void palloc_init (size_t user_page_limit)
    available, returns a null pointer, unless PAL_ASSERT is set in
    FLAGS, in which case the kernel panics. */
 void *palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
+{
+  return palloc_get_aligned (flags, page_cnt, 1);
+}
+
+/* Like palloc_get_multiple(), but the physical address of the
+   first page is a multiple of ALIGN pages. */
+void *palloc_get_aligned (enum palloc_flags flags, size_t page_cnt,
+                          size_t align)
 {
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
   size_t page_idx;
 
+  ASSERT (align > 0);
   if (page_cnt == 0)
     return NULL;
 
   lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  page_idx = scan_aligned (pool, page_cnt, align);
   lock_release (&pool->lock);
+  if (page_idx != BITMAP_ERROR)
+    pool_adjust_free (pool, -(int) page_cnt);
 
   if (page_idx != BITMAP_ERROR)
     pages = pool->base + PGSIZE * page_idx;
@@ -135,11 +151,27 @@ void palloc_free_multiple (void *pages, size_t page_cnt)
 
   ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
   bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  pool_adjust_free (pool, page_cnt);
 }
 
 /* Frees the page at PAGE. */
 void palloc_free_page (void *page) { palloc_free_multiple (page, 1); }
 
+/* Stores the first page of the user pool into *BASE and the
+   number of pages in it into *PAGE_CNT, so that user pages can
+   be numbered from 0. */
+void palloc_user_pool (void **base, size_t *page_cnt)
+{
+  *base = user_pool.base;
+  *page_cnt = bitmap_size (user_pool.used_map);
+}
+
+/* Returns the number of free pages in the user pool. */
+size_t palloc_user_free_cnt (void)
+{
+  return user_pool.free_cnt;
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void init_pool (struct pool *p, void *base, size_t page_cnt,
@@ -160,6 +192,31 @@ static void init_pool (struct pool *p, void *base, size_t page_cnt,
   lock_init (&p->lock);
   p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
   p->base = ((uint8_t *) base) + bm_pages * PGSIZE;
+  p->free_cnt = page_cnt;
+}
+
+/* Finds PAGE_CNT free pages in POOL whose first page is a
+   multiple of ALIGN pages in physical memory, marks them used and
+   returns the index of the first, or BITMAP_ERROR.  Must hold the
+   pool lock. */
+static size_t scan_aligned (struct pool *pool, size_t page_cnt, size_t align)
+{
+  size_t page_idx;
+
+  if (align == 1)
+    return bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+
+  /* PHYS_BASE is 4 MB aligned, so kernel virtual and physical
+     page numbers agree modulo any alignment up to 4 MB. */
+  page_idx = (align - pg_no (pool->base) % align) % align;
+  for (; page_idx + page_cnt <= bitmap_size (pool->used_map);
+       page_idx += align)
+    if (bitmap_none (pool->used_map, page_idx, page_cnt))
+      {
+        bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+        return page_idx;
+      }
+  return BITMAP_ERROR;
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -172,3 +229,14 @@ static bool page_from_pool (const struct pool *pool, void *page)
 
   return page_no >= start_page && page_no < end_page;
 }
+
+/* Adds DELTA to the free page count of POOL.  Pages are freed
+   from the scheduler with interrupts off (see
+   thread_schedule_tail()), where the pool lock cannot be
+   taken, so the count is updated with interrupts off instead. */
+static void pool_adjust_free (struct pool *pool, int delta)
+{
+  enum intr_level old_level = intr_disable ();
+  pool->free_cnt += delta;
+  intr_set_level (old_level);
+}
@@ -68,6 +68,7 @@ static inline uintptr_t pd_no (const void *va)
 #define PTE_U 0x4            /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20           /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40           /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80          /* 1=maps a 4 MB page (PDEs only). */
 
 /* Returns a PDE that points to page table PT. */
 static inline uint32_t pde_create (uint32_t *pt)
@@ -76,11 +77,29 @@ static inline uint32_t pde_create (uint32_t *pt)
   return vtop (pt) | PTE_U | PTE_P | PTE_W;
 }
 
+/* Returns a PDE that maps the 4 MB page at PAGE, which must be
+   4 MB aligned in physical memory, for user and kernel code.  Such
+   a PDE has accessed and dirty bits like a PTE.  Needs the PSE bit
+   of CR4, which paging_init() sets. */
+static inline uint32_t pde_create_large (void *page, bool writable)
+{
+  ASSERT (vtop (page) % PTSPAN == 0);
+  return vtop (page) | PTE_PS | PTE_U | PTE_P | (writable ? PTE_W : 0);
+}
+
+/* Returns true if PDE is present and maps a 4 MB page rather than
+   pointing to a page table. */
+static inline bool pde_is_large (uint32_t pde)
+{
+  return (pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS);
+}
+
 /* Returns a pointer to the page table that page directory entry
    PDE, which must "present", points to. */
 static inline uint32_t *pde_get_pt (uint32_t pde)
 {
   ASSERT (pde & PTE_P);
+  ASSERT (!pde_is_large (pde));
   return ptov (pde & PTE_ADDR);
 }
 
@@ -459,6 +459,8 @@ static void init_thread (struct thread *t, const char *name, int priority)
   t->magic = THREAD_MAGIC;
 #ifdef VM
     lock_init(&t->page_table_lock);
+    list_init(&t->mmap_list);
+    t->frame_limit = SIZE_MAX;
 #endif
   old_level = intr_disable ();
   list_push_back (&all_list, &t->allelem);
@@ -105,10 +105,22 @@ struct thread
 
   struct file** fd_table; // Map fd (index) to files
 #ifdef VM
-  struct hash* page_table;
+  struct page_table* page_table;
   void *esp;
   struct file* exec_file;
   struct lock page_table_lock;
+  struct list mmap_list;  // page_mmap_region made by mmap
+  int next_mapid;
+  void *around_start;     // first page mapped by the last fault-around
+  size_t around_cnt;      // pages it mapped, not yet settled
+  size_t around_window;   // pages the next fault-around may map, 0 until first used
+  size_t rss;             // resident pages it maps, kept by vm/frame.c
+  size_t rss_peak;
+  size_t wss;             // working set estimate, resident pages found accessed at the last sample
+  size_t frame_limit;     // resident pages it may keep before eviction prefers its own
+  bool frame_over;        // rss is above frame_limit
+  long long fault_cnt;    // faults that took a frame
+  long long fault_mark;   // system-wide fault count at its last one
 #endif
 
 #ifdef USERPROG
@@ -5,6 +5,7 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -153,7 +154,8 @@ static void page_fault (struct intr_frame *f)
      if(user){
          esp=f->esp;
      }
-  if(not_present && page_fault_handler(fault_addr, write, esp)) {
+  // a write to a present page may be the first write to a copy-on-write page
+  if((not_present || write) && page_fault_handler(fault_addr, write, esp)) {
     return;
   }
 #endif
@@ -8,6 +8,7 @@
 
 static uint32_t *active_pd (void);
 static void invalidate_pagedir (uint32_t *);
+static uint32_t peek_page (uint32_t *pd, const void *vaddr);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -32,25 +33,50 @@ void pagedir_destroy (uint32_t *pd)
 
   ASSERT (pd != init_page_dir);
   for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
-    if (*pde & PTE_P)
-      {
-        uint32_t *pt = pde_get_pt (*pde);
-        uint32_t *pte;
-
-        for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
-          if (*pte & PTE_P)
-            palloc_free_page (pte_get_page (*pte));
-        palloc_free_page (pt);
-      }
+    {
+      /* The frames of a 4 MB page belong to the frame table, which
+         frees them page by page, so the supplemental page table
+         must have split every large page before getting here. */
+      ASSERT (!pde_is_large (*pde));
+      if (*pde & PTE_P)
+        {
+          uint32_t *pt = pde_get_pt (*pde);
+          uint32_t *pte;
+
+          for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
+            if (*pte & PTE_P)
+              palloc_free_page (pte_get_page (*pte));
+          palloc_free_page (pt);
+        }
+    }
   palloc_free_page (pd);
 }
 
+/* Replaces the 4 MB page that PDE of PD maps by a page table
+   mapping the same memory with 4 kB pages, each with the
+   permissions and accessed and dirty bits of the 4 MB page.
+   Panics if there is no kernel page for the table, since the
+   callers that split cannot fail. */
+static void split_large_page (uint32_t *pd, uint32_t *pde)
+{
+  uint32_t *pt = palloc_get_page (PAL_ASSERT);
+  uint32_t flags = *pde & (PTE_P | PTE_W | PTE_U | PTE_A | PTE_D);
+  uintptr_t paddr = *pde & ~(uintptr_t) (PTSPAN - 1);
+  size_t i;
+
+  for (i = 0; i < PGSIZE / sizeof *pt; i++)
+    pt[i] = (paddr + i * PGSIZE) | flags;
+  *pde = pde_create (pt);
+  invalidate_pagedir (pd);
+}
+
 /* Returns the address of the page table entry for virtual
    address VADDR in page directory PD.
    If PD does not have a page table for VADDR, behavior depends
    on CREATE.  If CREATE is true, then a new page table is
    created and a pointer into it is returned.  Otherwise, a null
-   pointer is returned. */
+   pointer is returned.
+   A 4 MB page covering VADDR is split into 4 kB pages first. */
 static uint32_t *lookup_page (uint32_t *pd, const void *vaddr, bool create)
 {
   uint32_t *pt, *pde;
@@ -77,11 +103,29 @@ static uint32_t *lookup_page (uint32_t *pd, const void *vaddr, bool create)
         return NULL;
     }
 
+  if (pde_is_large (*pde))
+    split_large_page (pd, pde);
+
   /* Return the page table entry. */
   pt = pde_get_pt (*pde);
   return &pt[pt_no (vaddr)];
 }
 
+/* Returns the page table entry for VADDR in PD, 0 if there is
+   none.  For a 4 MB page, returns the entry that splitting it
+   would give, without splitting it. */
+static uint32_t peek_page (uint32_t *pd, const void *vaddr)
+{
+  uint32_t pde = pd[pd_no (vaddr)];
+
+  if (pde_is_large (pde))
+    return ((pde & ~(uint32_t) (PTSPAN - 1)) + pt_no (vaddr) * PGSIZE)
+           | (pde & (PTE_P | PTE_W | PTE_U | PTE_A | PTE_D));
+  if ((pde & PTE_P) == 0)
+    return 0;
+  return pde_get_pt (pde)[pt_no (vaddr)];
+}
+
 /* Adds a mapping in page directory PD from user virtual page
    UPAGE to the physical frame identified by kernel virtual
    address KPAGE.
@@ -114,19 +158,53 @@ bool pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
     return false;
 }
 
+/* Maps the 4 MB of user virtual memory at UPAGE to the 4 MB of
+   physical memory at kernel virtual address KPAGE with a single
+   page directory entry.  Both must be 4 MB aligned, and no page of
+   the range may be mapped.  KPAGE should probably be a run of pages
+   obtained from the user pool with palloc_get_aligned().
+   Clearing one of its pages or changing its bits splits it back
+   into 4 kB pages; reading them, or setting or clearing the
+   accessed bit that all of them share, does not.
+   Returns false if some page of the range is already mapped. */
+bool pagedir_set_large_page (uint32_t *pd, void *upage, void *kpage,
+                             bool writable)
+{
+  uint32_t *pde = pd + pd_no (upage);
+  size_t i;
+
+  ASSERT ((uintptr_t) upage % PTSPAN == 0);
+  ASSERT (is_user_vaddr (upage));
+  ASSERT (pd != init_page_dir);
+
+  if (*pde != 0)
+    {
+      /* A page table left with nothing mapped can go. */
+      uint32_t *pt = pde_get_pt (*pde);
+      for (i = 0; i < PGSIZE / sizeof *pt; i++)
+        if (pt[i] & PTE_P)
+          return false;
+      *pde = 0;
+      invalidate_pagedir (pd);
+      palloc_free_page (pt);
+    }
+  *pde = pde_create_large (kpage, writable);
+  return true;
+}
+
 /* Looks up the physical address that corresponds to user virtual
    address UADDR in PD.  Returns the kernel virtual address
    corresponding to that physical address, or a null pointer if
    UADDR is unmapped. */
 void *pagedir_get_page (uint32_t *pd, const void *uaddr)
 {
-  uint32_t *pte;
+  uint32_t pte;
 
   ASSERT (is_user_vaddr (uaddr));
 
-  pte = lookup_page (pd, uaddr, false);
-  if (pte != NULL && (*pte & PTE_P) != 0)
-    return ((uint8_t *) pte_get_page (*pte)) + pg_ofs (uaddr);
+  pte = peek_page (pd, uaddr);
+  if ((pte & PTE_P) != 0)
+    return ((uint8_t *) pte_get_page (pte)) + pg_ofs (uaddr);
   else
     return NULL;
 }
@@ -142,6 +220,8 @@ void pagedir_clear_page (uint32_t *pd, void *upage)
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (is_user_vaddr (upage));
 
+  if ((peek_page (pd, upage) & PTE_P) == 0)
+    return;
   pte = lookup_page (pd, upage, false);
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
@@ -150,21 +230,48 @@ void pagedir_clear_page (uint32_t *pd, void *upage)
     }
 }
 
+/* Marks the CNT user virtual pages in UPAGES "not present" in PD
+   like pagedir_clear_page(), but invalidates the TLB only once. */
+void pagedir_clear_pages (uint32_t *pd, void **upages, size_t cnt)
+{
+  bool cleared = false;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      uint32_t *pte;
+
+      ASSERT (pg_ofs (upages[i]) == 0);
+      ASSERT (is_user_vaddr (upages[i]));
+
+      if ((peek_page (pd, upages[i]) & PTE_P) == 0)
+        continue;
+      pte = lookup_page (pd, upages[i], false);
+      *pte &= ~PTE_P;
+      cleared = true;
+    }
+  if (cleared)
+    invalidate_pagedir (pd);
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
    installed.
    Returns false if PD contains no PTE for VPAGE. */
 bool pagedir_is_dirty (uint32_t *pd, const void *vpage)
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
-  return pte != NULL && (*pte & PTE_D) != 0;
+  return (peek_page (pd, vpage) & PTE_D) != 0;
 }
 
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
    in PD. */
 void pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
+  uint32_t *pte;
+
+  if (pagedir_is_dirty (pd, vpage) == dirty)
+    return;
+  pte = lookup_page (pd, vpage, false);
   if (pte != NULL)
     {
       if (dirty)
@@ -177,21 +284,49 @@ void pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
     }
 }
 
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+   VPAGE in PD, keeping the page mapped. */
+void pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable)
+{
+  uint32_t *pte;
+
+  if (((peek_page (pd, vpage) & PTE_W) != 0) == writable)
+    return;
+  pte = lookup_page (pd, vpage, false);
+  if (pte != NULL)
+    {
+      if (writable)
+        *pte |= PTE_W;
+      else
+        {
+          *pte &= ~(uint32_t) PTE_W;
+          invalidate_pagedir (pd);
+        }
+    }
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD has been
    accessed recently, that is, between the time the PTE was
    installed and the last time it was cleared.  Returns false if
    PD contains no PTE for VPAGE. */
 bool pagedir_is_accessed (uint32_t *pd, const void *vpage)
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
-  return pte != NULL && (*pte & PTE_A) != 0;
+  return (peek_page (pd, vpage) & PTE_A) != 0;
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
-   VPAGE in PD. */
+   VPAGE in PD.  If VPAGE is part of a 4 MB page, sets the one
+   accessed bit of the whole 4 MB page, without splitting it. */
 void pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
+  uint32_t *pte;
+
+  if (pagedir_is_accessed (pd, vpage) == accessed)
+    return;
+  if (pagedir_is_large (pd, vpage))
+    pte = pd + pd_no (vpage);
+  else
+    pte = lookup_page (pd, vpage, false);
   if (pte != NULL)
     {
       if (accessed)
@@ -204,6 +339,13 @@ void pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
     }
 }
 
+/* Returns true if virtual page VPAGE in PD is mapped as part of
+   a 4 MB page. */
+bool pagedir_is_large (uint32_t *pd, const void *vpage)
+{
+  return pde_is_large (pd[pd_no (vpage)]);
+}
+
 /* Loads page directory PD into the CPU's page directory base
    register. */
 void pagedir_activate (uint32_t *pd)
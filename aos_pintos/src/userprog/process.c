@@ -26,6 +26,9 @@
 #define ALIGN(ADDR) ((void *) ((uintptr_t) ADDR - (uintptr_t) ADDR % 4))
 
 static thread_func start_process NO_RETURN;
+#ifdef VM
+static thread_func start_fork NO_RETURN;
+#endif
 
 /* Starts a new thread running a user program loaded from
    FILENAME.  The new thread may be scheduled (and may even exit)
@@ -96,6 +99,87 @@ static void start_process (void *filename)
     NOT_REACHED ();
 }
 
+#ifdef VM
+/* Starts a new process that is a copy of the current one, about
+   to return from the system call whose user context is F.  The
+   caller must wait on child_created before it runs user code
+   again, since the child copies its address space meanwhile.
+   Returns the new process's thread id, or TID_ERROR if the
+   thread cannot be created. */
+tid_t process_fork (const struct intr_frame *f)
+{
+    struct intr_frame *if_copy = malloc (sizeof *if_copy);
+    tid_t tid;
+
+    if (if_copy == NULL)
+        return TID_ERROR;
+    *if_copy = *f;
+    tid = thread_create (thread_current ()->name, PRI_DEFAULT, start_fork, if_copy);
+    if (tid == TID_ERROR)
+        free (if_copy);
+    return tid;
+}
+
+/* Copies the state of the parent process into the current
+   thread: address space, executable and open files. */
+static bool fork_state (struct thread *parent)
+{
+    struct thread *cur = thread_current ();
+
+    cur->page_table = page_create_table ();
+    if (cur->page_table == NULL)
+        return false;
+    cur->pagedir = pagedir_create ();
+    if (cur->pagedir == NULL)
+        return false;
+    process_activate ();
+
+    bool success = true;
+    file_lock ();
+    cur->exec_file = file_reopen (parent->exec_file);
+    for (int fd = 2; fd < MAX_OPEN_FILES; fd++)
+    {
+        struct file *file = parent->fd_table[fd];
+        if (file != NULL)
+        {
+            cur->fd_table[fd] = file_reopen (file);
+            if (cur->fd_table[fd] == NULL)
+            {
+                success = false;
+                break;
+            }
+            file_seek (cur->fd_table[fd], file_tell (file));
+        }
+    }
+    file_unlock ();
+    return success && cur->exec_file != NULL && page_fork (parent);
+}
+
+/* A thread function that continues a forked process where its
+   parent made the fork system call, returning 0 to it. */
+static void start_fork (void *f)
+{
+    struct intr_frame if_ = *(struct intr_frame *) f;
+    struct thread *parent = thread_current ()->parent;
+    bool success;
+
+    free (f);
+    success = fork_state (parent);
+
+    parent->success = success;
+    sema_up (&parent->child_created);
+    if (!success)
+    {
+        exit (-1);
+    }
+
+    if_.eax = 0;
+    thread_current ()->esp = if_.esp;
+    asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g"(&if_) : "memory");
+    NOT_REACHED ();
+}
+#endif
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -142,11 +226,13 @@ void process_exit (void)
 
 
 #ifdef VM
-    // Destory the page owned by thread
+    // Destory the page owned by thread.
+    // the table goes first, shared pages are keyed by the inode of exec_file
+  page_munmap_all();
+  page_destroy_table(cur->page_table);
   if(cur->exec_file!=NULL){
     file_close(cur->exec_file);
   }
-  page_destroy_table(cur->page_table);
 #endif
 
     /* Destroy the current process's page directory and switch back
@@ -28,31 +28,50 @@ static void syscall_handler (struct intr_frame *);
 static bool valid_ptr (void *);
 
 static struct lock filesys_mutex; // Ensure mutual exclusion to filesys
-static bool filesys_lock_flag=false;
 
-bool filesys_lock_held_by_current_thread (){
-    return lock_held_by_current_thread (&filesys_mutex);
+void file_lock(){
+    lock_acquire(&filesys_mutex);
 }
-
-void acquire_filesys_lock() {
-    if(!filesys_lock_held_by_current_thread()) {
-        lock_acquire(&filesys_mutex);
-        filesys_lock_flag=true;
-    }
+void file_unlock(){
+    lock_release(&filesys_mutex);
 }
 
-void release_filesys_lock(){
-    if(filesys_lock_flag) {
-        filesys_lock_flag=false;
-        lock_release(&filesys_mutex);
+/* The page fault path reads files under filesys_mutex, so user
+   memory the file system touches with the lock held must not fault:
+   it is faulted in and pinned before taking the lock.  A bad pointer
+   exits here rather than with the lock held. */
+static void pin_buffer (const void *buffer UNUSED, unsigned size UNUSED,
+                        bool write UNUSED)
+{
+#ifdef VM
+  if (!page_pin_range (buffer, size, write))
+    {
+      exit (-1);
     }
+#endif
 }
 
-void file_lock(){
-    lock_acquire(&filesys_mutex);
+static void unpin_buffer (const void *buffer UNUSED, unsigned size UNUSED)
+{
+#ifdef VM
+  page_unpin_range (buffer, size);
+#endif
 }
-void file_unlock(){
-    lock_release(&filesys_mutex);
+
+/* Pins the string at STR like pin_buffer, returns the size to pass
+   to unpin_buffer. */
+static unsigned pin_string (const char *str UNUSED)
+{
+#ifdef VM
+  unsigned size = page_pin_string (str);
+  if (size == 0)
+    {
+      exit (-1);
+    }
+  return size;
+#else
+  return 0;
+#endif
 }
 
 const int MAX_OPEN_FILES = 1024; // Max open files per process
@@ -207,6 +226,28 @@ static void syscall_handler (struct intr_frame *f UNUSED)
         char *linkpath = *((char **) f->esp + 2);
         f->eax = symlink (target, linkpath);
         break;
+#ifdef VM
+      case SYS_MMAP:
+        if (check_args (f->esp, 2))
+          {
+            exit (-1);
+          }
+        int fd_m = *((int *) f->esp + 1);
+        void *addr = *((void **) f->esp + 2);
+        f->eax = mmap (fd_m, addr);
+        break;
+      case SYS_MUNMAP:
+        if (check_args (f->esp, 1))
+          {
+            exit (-1);
+          }
+        mapid_t mapping = *((mapid_t *) f->esp + 1);
+        munmap (mapping);
+        break;
+      case SYS_FORK:
+        f->eax = sys_fork (f);
+        break;
+#endif
     }
 }
 
@@ -295,9 +336,11 @@ bool create (const char *file, unsigned initial_size)
       exit (-1);
     }
 
+  unsigned name_size = pin_string (file);
   file_lock();
   bool opened = filesys_create (file, initial_size);
   file_unlock();
+  unpin_buffer (file, name_size);
 
   return opened;
 }
@@ -308,9 +351,11 @@ bool remove (const char *file)
     {
       exit (-1);
     }
+  unsigned name_size = pin_string (file);
   file_lock();
   bool removed = filesys_remove (file);
   file_unlock();
+  unpin_buffer (file, name_size);
   return removed;
 }
 
@@ -335,9 +380,11 @@ int open (const char *filename)
         }
     }
 
+  unsigned name_size = pin_string (filename);
   file_lock();
   struct file *file = filesys_open (filename);
   file_unlock();
+  unpin_buffer (filename, name_size);
   if (file == NULL)
     {
       return -1;
@@ -377,12 +424,6 @@ int read (int fd, void *buffer, unsigned size)
       return 0;
     }
 
-  // check if page exists however is not writeable. For project 2 tests, entry will be NULL
-  struct page_table_entry* entry = page_find(thread_current()->page_table, pg_round_down(buffer));
-  if ((entry != NULL) && !(entry->writable)){
-    exit(-1);
-  }
-
   unsigned bytes_read = 0;
 
   // Read from stdin
@@ -396,9 +437,11 @@ int read (int fd, void *buffer, unsigned size)
     }
   else // Read from file
     {
+      pin_buffer (buffer, size, true);
       file_lock();
       bytes_read = file_read (file, buffer, size);
       file_unlock();
+      unpin_buffer (buffer, size);
     }
 
   return bytes_read;
@@ -426,9 +469,11 @@ int write (int fd, const void *buffer, unsigned size)
       return 0;
     }
 
+  pin_buffer (buffer, size, false);
   file_lock();
   unsigned bytes_written = file_write (file, buffer, size);
   file_unlock();
+  unpin_buffer (buffer, size);
   return bytes_written;
 }
 
@@ -480,22 +525,68 @@ void close (int fd)
 
 int symlink (char *target, char *linkpath)
 {
+  unsigned target_size = pin_string (target);
+  unsigned linkpath_size = pin_string (linkpath);
   file_lock();
   struct file *target_file = filesys_open (target);
+  bool success = target_file != NULL && filesys_symlink (target, linkpath);
   file_unlock();
+  unpin_buffer (linkpath, linkpath_size);
+  unpin_buffer (target, target_size);
+
+  return success ? 0 : -1;
+}
 
-  if (target_file == NULL)
+#ifdef VM
+mapid_t mmap (int fd, void *addr)
+{
+  if (fd < 2 || fd >= MAX_OPEN_FILES)
     {
-      return -1;
+      return MAP_FAILED;
+    }
+  struct file *file = thread_current ()->fd_table[fd];
+  if (file == NULL)
+    {
+      return MAP_FAILED;
     }
 
+  // the mapping keeps its own file, so it survives close (fd)
   file_lock();
-  bool success = filesys_symlink (target, linkpath);
+  file = file_reopen (file);
+  off_t length = file != NULL ? file_length (file) : 0;
   file_unlock();
+  if (file == NULL)
+    {
+      return MAP_FAILED;
+    }
 
-  return success ? 0 : -1;
+  mapid_t mapping = page_mmap (file, addr, length);
+  if (mapping == MAP_FAILED)
+    {
+      file_lock();
+      file_close (file);
+      file_unlock();
+    }
+  return mapping;
 }
 
+void munmap (mapid_t mapping) { page_munmap (mapping); }
+
+pid_t sys_fork (const struct intr_frame *f)
+{
+  int tid = process_fork (f);
+  if (tid == TID_ERROR)
+    {
+      return -1;
+    }
+
+  sema_down (&thread_current ()->child_created); // wait for the copy
+  tid = !thread_current ()->success ? -1 : tid;
+  thread_current ()->success = false;
+  return tid;
+}
+#endif
+
 bool valid_ptr (void *ptr)
 {
     if( ptr == NULL || is_kernel_vaddr (ptr)){
@@ -4,6 +4,9 @@
 #include <stdbool.h>
 
 typedef int pid_t;
+extern const int MAX_OPEN_FILES;
+typedef int mapid_t;
+#define MAP_FAILED ((mapid_t) -1)
 void syscall_init (void);
 void halt (void);
 void exit (int);
@@ -19,7 +22,10 @@ void seek (int, unsigned);
 unsigned tell (int);
 void close (int);
 int symlink (char *, char *);
-void acquire_filesys_lock();
-void release_filesys_lock();
-bool filesys_lock_held_by_current_thread();
+mapid_t mmap (int, void *);
+void munmap (mapid_t);
+struct intr_frame;
+pid_t sys_fork (const struct intr_frame *);
+void file_lock();
+void file_unlock();
 #endif /* userprog/syscall.h */
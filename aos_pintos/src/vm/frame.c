@@ -8,80 +8,551 @@
 #include "lib/debug.h"
 #include "lib/string.h"
 #include "lib/stddef.h"
+#include "threads/pte.h"
 #include "threads/vaddr.h"
-static struct hash frame_table;
-static struct list frame_list;
+#include <round.h>
+//one entry per page of the user pool, indexed by its number in the pool
+static struct frame_table_entry *frame_table;
+static uint8_t *frame_base;
+static size_t frame_table_size;
+//swept over frame_table to pick victims (second chance)
+static size_t clock_hand;
+static size_t frame_cnt;
 static struct lock frame_table_lock;
-static unsigned frame_hash(const struct hash_elem *e, void* aux UNUSED);
-static bool frame_hash_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED);
-struct frame_table_entry* frame_create_frame_table_entry(void* upage,void* frame);
+//read-only file pages mapped by more than one process, keyed by (inode, file_ofs)
+static struct hash shared_table;
+//-lowat, -hiwat: the pageout thread is woken when fewer than frame_low_watermark
+//user pages are free, and evicts until frame_high_watermark pages are free
+size_t frame_low_watermark = FRAME_LOW_WATERMARK;
+size_t frame_high_watermark = FRAME_HIGH_WATERMARK;
+//upped to wake the pageout thread, pageout_awake keeps it from being upped twice
+static struct semaphore pageout_sema;
+static bool pageout_awake;
+//-pff: see FRAME_PFF_INTERVAL, 0 leaves every process unlimited
+size_t frame_pff_interval = FRAME_PFF_INTERVAL;
+//faults that took a frame in the whole system, the clock fault intervals are measured on
+static long long frame_fault_clock;
+//processes whose rss is above their allowance
+static size_t frame_over_cnt;
 
-static bool frame_hash_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED){
-    struct frame_table_entry* fa = hash_entry(a,  struct frame_table_entry, he);
-    struct frame_table_entry* fb = hash_entry(b,  struct frame_table_entry, he);
-    return fa->frame < fb->frame;
+//page usage of an exited process
+struct frame_proc_stats{
+    char name[16];
+    tid_t tid;
+    long long fault_cnt;
+    size_t rss_peak;
+    size_t wss;
+    size_t frame_limit;
+};
+//the last processes to exit, kept for frame_print_stats
+#define FRAME_PROC_HISTORY 8
+static struct frame_proc_stats frame_proc_history[FRAME_PROC_HISTORY];
+static size_t frame_proc_exit_cnt;
+
+//statistics
+static long long frame_evict_cnt;
+static long long frame_scan_cnt;
+static long long frame_cluster_cnt;
+static long long frame_prefetch_cnt;
+static long long frame_prefetch_hit_cnt;
+static long long frame_shared_hit_cnt;
+static long long frame_cow_copy_cnt;
+static long long frame_sync_evict_cnt;
+static long long frame_pageout_cnt;
+static long long frame_pageout_wake_cnt;
+static long long frame_pff_grow_cnt;
+static long long frame_pff_shrink_cnt;
+static long long frame_over_evict_cnt;
+
+static void frame_pageout(void *aux UNUSED);
+
+static bool frame_shared_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED){
+    struct frame_table_entry* fa = hash_entry(a,  struct frame_table_entry, se);
+    struct frame_table_entry* fb = hash_entry(b,  struct frame_table_entry, se);
+    return fa->inode != fb->inode ? fa->inode < fb->inode : fa->file_ofs < fb->file_ofs;
 }
 
-static unsigned frame_hash(const struct hash_elem *e, void* aux UNUSED){
-    struct frame_table_entry* f= hash_entry(e, struct frame_table_entry, he);
-    return hash_bytes(&f->frame, sizeof(f->frame));
+static unsigned frame_shared_hash(const struct hash_elem *e, void* aux UNUSED){
+    struct frame_table_entry* f= hash_entry(e, struct frame_table_entry, se);
+    return hash_bytes(&f->inode, sizeof(f->inode)) ^ hash_int(f->file_ofs);
 }
 
+//the user pool is fixed at boot, so the table is sized and allocated once
 void frame_init() {
-    hash_init(&frame_table, frame_hash, frame_hash_less, NULL);
-    list_init(&frame_list);
+    void *base;
+    palloc_user_pool(&base, &frame_table_size);
+    frame_base = base;
+    frame_table = palloc_get_multiple(PAL_ZERO | PAL_ASSERT,
+                                      DIV_ROUND_UP(frame_table_size * sizeof(struct frame_table_entry), PGSIZE));
+    hash_init(&shared_table, frame_shared_hash, frame_shared_less, NULL);
+    for (size_t i = 0; i < frame_table_size; i++) {
+        cond_init(&frame_table[i].transit);
+    }
+    clock_hand = 0;
+    frame_cnt = 0;
     lock_init(&frame_table_lock);
+    //keep most of the pool for processes
+    if (frame_high_watermark > frame_table_size / 4) {
+        frame_high_watermark = frame_table_size / 4;
+    }
+    if (frame_low_watermark > frame_high_watermark) {
+        frame_low_watermark = frame_high_watermark;
+    }
+    sema_init(&pageout_sema, 0);
+    pageout_awake = false;
+    if (frame_low_watermark > 0) {
+        thread_create("pageout", PRI_DEFAULT, frame_pageout, NULL);
+    }
 }
 
-struct frame_table_entry* frame_create_frame_table_entry(void* upage,void* frame){
-    struct frame_table_entry* entry= (struct frame_table_entry*)malloc(sizeof (struct frame_table_entry));
+//slot of frame, which must be a page of the user pool
+static struct frame_table_entry* frame_slot(void *frame) {
+    size_t idx = ((uint8_t *)frame - frame_base) / PGSIZE;
+    ASSERT((uint8_t *)frame >= frame_base && idx < frame_table_size);
+    return &frame_table[idx];
+}
+
+//keep t->frame_over and frame_over_cnt up to date after t's rss or allowance changed.
+//must hold frame_table_lock
+static void frame_check_over(struct thread *t) {
+    bool over = t->rss > t->frame_limit;
+    if (over != t->frame_over) {
+        t->frame_over = over;
+        if (over) {
+            frame_over_cnt++;
+        } else {
+            frame_over_cnt--;
+        }
+    }
+}
+
+//count a mapping of a resident page added to t, delta 1, or dropped from it, delta -1.
+//must hold frame_table_lock
+static void frame_account(struct thread *t, int delta) {
+    t->rss += delta;
+    if (t->rss > t->rss_peak) {
+        t->rss_peak = t->rss;
+    }
+    frame_check_over(t);
+}
+
+//frame_account every mapping of entry
+static void frame_account_mappings(struct frame_table_entry *entry, int delta) {
+    frame_account(entry->holder, delta);
+    for (struct list_elem *e = list_begin(&entry->rmap); e != list_end(&entry->rmap); e = list_next(e)) {
+        frame_account(list_entry(e, struct frame_mapping, elem)->holder, delta);
+    }
+}
+
+//take the slot of a page just got from the user pool for upage of the current thread
+static struct frame_table_entry* frame_claim(void* upage,void* frame){
+    struct frame_table_entry* entry= frame_slot(frame);
+    ASSERT(entry->frame == NULL);
+    frame_cnt++;
+    frame_account(thread_current(), 1);
     entry->frame = frame;
     entry->upage = upage;
     entry->holder = thread_current();
+    entry->pinned = 1;
+    entry->prefetched = false;
+    entry->in_transit = false;
+    entry->holder_locked = false;
+    entry->refcnt = 1;
+    list_init(&entry->rmap);
+    entry->inode = NULL;
     return entry;
 }
 
+//entry of frame, NULL if frame is not a user page held by the frame table
 struct frame_table_entry* frame_find_entry(void *frame) {
-    struct frame_table_entry temp_entry;
-    temp_entry.frame=frame;
-    struct hash_elem* e= hash_find(&frame_table,&(temp_entry.he));
-    return e!=NULL?hash_entry(e,struct frame_table_entry,he):NULL;
+    uint8_t *page = frame;
+    if (page < frame_base || page >= frame_base + frame_table_size * PGSIZE) {
+        return NULL;
+    }
+    struct frame_table_entry *entry = frame_slot(frame);
+    return entry->frame != NULL ? entry : NULL;
 }
 
-// call it in timer to approximate LRU.
-void frame_lift_fr(bool execute) {
-    if(!execute){
-        return;
-    }
+//return the next frame under the clock hand and advance the hand,
+//skipping user pages that are not frames and wrapping around at the end of the pool.
+//there must be at least one frame.
+static struct frame_table_entry* frame_clock_advance(void) {
     struct frame_table_entry *entry;
-    for (struct list_elem* e = list_rbegin(&frame_list); e != list_rend(&frame_list); e = list_prev(e)){
-        entry= list_entry(e, struct frame_table_entry, le);
-        if(pagedir_is_accessed(entry->holder->pagedir, entry->upage)){
-            pagedir_set_accessed(entry->holder->pagedir, entry->upage, false);
-            list_remove(&entry->le);
-            list_push_front(&frame_list,&entry->le);
-            break;
+    ASSERT(frame_cnt > 0);
+    do {
+        entry = &frame_table[clock_hand];
+        clock_hand = (clock_hand + 1) % frame_table_size;
+    } while (entry->frame == NULL);
+    frame_scan_cnt++;
+    return entry;
+}
+
+//settle a read-ahead frame: count a hit once its page has been accessed.
+//must be called before the accessed bit is cleared.
+static void frame_check_prefetch(struct frame_table_entry *entry) {
+    if (entry->prefetched && pagedir_is_accessed(entry->holder->pagedir, entry->upage)) {
+        entry->prefetched = false;
+        frame_prefetch_hit_cnt++;
+    }
+}
+
+//true if the page has been accessed through any of its mappings
+static bool frame_is_accessed(struct frame_table_entry *entry) {
+    if (pagedir_is_accessed(entry->holder->pagedir, entry->upage)) {
+        return true;
+    }
+    for (struct list_elem *e = list_begin(&entry->rmap); e != list_end(&entry->rmap); e = list_next(e)) {
+        struct frame_mapping *m = list_entry(e, struct frame_mapping, elem);
+        if (pagedir_is_accessed(m->holder->pagedir, m->upage)) {
+            return true;
         }
     }
+    return false;
 }
 
-struct frame_table_entry* frame_get_used_fr(void *upage) {
+//clear the accessed bit of every mapping of the page
+static void frame_clear_accessed(struct frame_table_entry *entry) {
+    pagedir_set_accessed(entry->holder->pagedir, entry->upage, false);
+    for (struct list_elem *e = list_begin(&entry->rmap); e != list_end(&entry->rmap); e = list_next(e)) {
+        struct frame_mapping *m = list_entry(e, struct frame_mapping, elem);
+        pagedir_set_accessed(m->holder->pagedir, m->upage, false);
+    }
+}
+
+//take t's page_table_lock for an eviction without blocking, *taken telling whether it was
+//taken here rather than already held by the evicting thread. return false if it is busy
+static bool frame_trylock(struct thread *t, bool *taken) {
+    *taken = false;
+    if (lock_held_by_current_thread(&t->page_table_lock)) {
+        return true;
+    }
+    return *taken = lock_try_acquire(&t->page_table_lock);
+}
+
+//release the page_table_locks frame_lock_holders took for entry
+static void frame_unlock_holders(struct frame_table_entry *entry) {
+    for (struct list_elem *e = list_begin(&entry->rmap); e != list_end(&entry->rmap); e = list_next(e)) {
+        struct frame_mapping *m = list_entry(e, struct frame_mapping, elem);
+        if (m->locked) {
+            m->locked = false;
+            lock_release(&m->holder->page_table_lock);
+        }
+    }
+    if (entry->holder_locked) {
+        entry->holder_locked = false;
+        lock_release(&entry->holder->page_table_lock);
+    }
+}
+
+//take the page_table_lock of every process mapping entry: evicting it rewrites their
+//page table entries, which they read and write under that lock alone.
+//never blocks, return false, holding none of them, if one is busy.
+static bool frame_lock_holders(struct frame_table_entry *entry) {
+    if (!frame_trylock(entry->holder, &entry->holder_locked)) {
+        return false;
+    }
+    for (struct list_elem *e = list_begin(&entry->rmap); e != list_end(&entry->rmap); e = list_next(e)) {
+        struct frame_mapping *m = list_entry(e, struct frame_mapping, elem);
+        if (!frame_trylock(m->holder, &m->locked)) {
+            // the mappings not tried yet have locked clear
+            frame_unlock_holders(entry);
+            return false;
+        }
+    }
+    return true;
+}
+
+//if entry's page is part of a 4 MB page, move the clock hand past the other frames of it:
+//they share one accessed and dirty bit, so one look covers them all, and aging them one by one
+//would make the rest look cold as soon as the first cleared the bit
+static void frame_clock_skip_large(struct frame_table_entry *entry) {
+    if (pagedir_is_large(entry->holder->pagedir, entry->upage)) {
+        uint8_t *end = (uint8_t *)((uintptr_t)entry->frame & ~(uintptr_t)(PTSPAN - 1)) + PTSPAN;
+        size_t idx = (end - frame_base) / PGSIZE;
+        clock_hand = idx < frame_table_size ? idx : 0;
+    }
+}
+
+//true if the clock may take entry: it is not pinned and,
+//if over_only, its holder is above its allowance
+static bool frame_clock_eligible(struct frame_table_entry *entry, bool over_only) {
+    return !entry->pinned && (!over_only || entry->holder->frame_over);
+}
+
+//enhanced second chance over the eligible frames.
+//the first sweep looks for a frame that is neither accessed nor dirty and leaves the bits alone,
+//the second sweep takes the first frame that is not accessed and clears the accessed bit of every frame it passes.
+//after one round every eligible frame has lost its accessed bit, so the second round always finds a victim
+//unless no frame is eligible or the processes mapping each candidate are busy.
+//a 4 MB page is looked at and aged once per sweep, and only split when one of its frames is taken.
+//the victim is returned with frame_lock_holders done.
+static struct frame_table_entry* frame_clock_select(bool over_only) {
+    for (int round = 0; round < 2; round++) {
+        for (size_t i = 0; i < frame_cnt; i++) {
+            struct frame_table_entry *entry = frame_clock_advance();
+            if (!frame_clock_eligible(entry, over_only)) {
+                continue;
+            }
+            frame_check_prefetch(entry);
+            if (!frame_is_accessed(entry) && !pagedir_is_dirty(entry->holder->pagedir, entry->upage)
+                && frame_lock_holders(entry)) {
+                return entry;
+            }
+            frame_clock_skip_large(entry);
+        }
+        for (size_t i = 0; i < frame_cnt; i++) {
+            struct frame_table_entry *entry = frame_clock_advance();
+            if (!frame_clock_eligible(entry, over_only)) {
+                continue;
+            }
+            frame_check_prefetch(entry);
+            if (!frame_is_accessed(entry)) {
+                if (frame_lock_holders(entry)) {
+                    return entry;
+                }
+            } else {
+                frame_clear_accessed(entry);
+            }
+            frame_clock_skip_large(entry);
+        }
+    }
+    return NULL;
+}
+
+//take entry out of the shared-page registry, it becomes private again
+static void frame_unshare(struct frame_table_entry *entry) {
+    if (entry->inode != NULL) {
+        hash_delete(&shared_table, &entry->se);
+        entry->inode = NULL;
+    }
+}
+
+//take the frame of an entry with no mapping left out of the table and return it,
+//the caller gives it back to palloc
+static void* frame_detach_entry(struct frame_table_entry *entry) {
+    void *frame = entry->frame;
+    ASSERT(list_empty(&entry->rmap));
+    frame_unshare(entry);
+    frame_cnt--;
+    entry->frame = NULL;
+    return frame;
+}
 
-    struct list_elem* e =list_pop_back(&frame_list);
-    ASSERT(e!=NULL);
-    struct frame_table_entry *entry = list_entry(e, struct frame_table_entry, le);
+//free the frame of an entry that was evicted along with a cluster
+static void frame_release_entry(struct frame_table_entry *entry) {
+    palloc_free_page(frame_detach_entry(entry));
+}
 
-    block_sector_t index = swap_store(entry->frame);
-        if (index == (block_sector_t)-1) {
-            return NULL;
+//pick a victim, from a process above its allowance if there is one, and, if it goes to swap,
+//the cold pages that follow it in the holder's address space, so they land in contiguous swap slots.
+//each is pinned, marked in transit and taken out of the shared-page registry, and its mappings
+//are no longer counted in the rss of their processes. the page_table_lock of every process
+//mapping the victim is held until frame_finish_victims. must hold frame_table_lock.
+//return how many were picked, victims[0] being the victim, 0 if every frame is pinned.
+static size_t frame_pick_victims(struct frame_table_entry **victims) {
+    struct frame_table_entry *victim = NULL;
+    size_t cnt = 0;
+    if (frame_over_cnt > 0 && (victim = frame_clock_select(true)) != NULL) {
+        frame_over_evict_cnt++;
+    }
+    if (victim == NULL && (victim = frame_clock_select(false)) == NULL) {
+        return 0;
+    }
+    victims[cnt++] = victim;
+    struct thread *holder = victim->holder;
+    if (victim->refcnt == 1 && page_needs_swap(holder, victim->upage)) {
+        while (cnt < SWAP_CLUSTER) {
+            void *upage = (uint8_t *)victim->upage + cnt * PGSIZE;
+            if (!is_user_vaddr(upage)) {
+                break;
+            }
+            void *kpage = pagedir_get_page(holder->pagedir, upage);
+            struct frame_table_entry *entry = kpage != NULL ? frame_find_entry(kpage) : NULL;
+            if (entry == NULL || entry->holder != holder || entry->pinned || entry->refcnt > 1
+                || pagedir_is_accessed(holder->pagedir, upage) || !page_needs_swap(holder, upage)) {
+                break;
+            }
+            victims[cnt++] = entry;
         }
-    ASSERT(page_evict_upage(entry->holder, entry->upage, index));
+    }
+    for (size_t i = 0; i < cnt; i++) {
+        victims[i]->pinned++;
+        victims[i]->in_transit = true;
+        frame_unshare(victims[i]);
+        frame_account_mappings(victims[i], -1);
+    }
+    return cnt;
+}
+
+//unmap a shared frame from every process but its holder, each owner saving its own copy,
+//and give back each owner's page_table_lock once its copy is saved.
+//return false, with the remaining mappings in place, if one of them could not be saved.
+//runs without frame_table_lock: nobody else changes the mappings of a frame in transit.
+static bool frame_evict_mappings(struct frame_table_entry *entry) {
+    while (!list_empty(&entry->rmap)) {
+        struct frame_mapping *m = list_entry(list_front(&entry->rmap), struct frame_mapping, elem);
+        if (!page_evict_upage(m->holder, m->upage)) {
+            return false;
+        }
+        lock_acquire(&frame_table_lock);
+        list_remove(&m->elem);
+        entry->refcnt--;
+        lock_release(&frame_table_lock);
+        if (m->locked) {
+            lock_release(&m->holder->page_table_lock);
+        }
+        free(m);
+    }
+    return true;
+}
+
+//save and unmap the pages got from frame_pick_victims, without frame_table_lock.
+//return how many of them are saved: all of them, only the victim, or none.
+static size_t frame_save_victims(struct frame_table_entry **victims, size_t cnt) {
+    struct frame_table_entry *victim = victims[0];
+    if (!frame_evict_mappings(victim)) {
+        return 0;
+    }
+    if (cnt > 1 && page_evict_cluster(victim->holder, victim->upage, cnt)) {
+        return cnt;
+    }
+    return page_evict_upage(victim->holder, victim->upage) ? 1 : 0;
+}
+
+//end the transit of the victims, waking whoever waits on them, and release the page_table_locks
+//still held for the victim. the frames of the saved pages but the victim's are freed,
+//the mappings left on the others are counted again. must hold frame_table_lock.
+static void frame_finish_victims(struct frame_table_entry **victims, size_t cnt, size_t saved) {
+    for (size_t i = 0; i < cnt; i++) {
+        if (i >= saved) {
+            frame_account_mappings(victims[i], 1);
+        }
+        victims[i]->in_transit = false;
+        victims[i]->pinned--;
+        cond_broadcast(&victims[i]->transit, &frame_table_lock);
+        if (i > 0 && i < saved) {
+            frame_release_entry(victims[i]);
+        }
+    }
+    frame_unlock_holders(victims[0]);
+    frame_evict_cnt += saved;
+    if (saved > 1) {
+        frame_cluster_cnt++;
+    }
+}
+
+//evict a victim, and its cluster, in three steps so that frame_table_lock is not held
+//during the disk I/O. must hold frame_table_lock, which is released and reacquired.
+//return the victim, whose frame is now unmapped but still held, or NULL on failure.
+//*saved is set to the number of pages evicted.
+static struct frame_table_entry* frame_evict(size_t *saved) {
+    struct frame_table_entry *victims[SWAP_CLUSTER];
+    size_t cnt = frame_pick_victims(victims);
+    *saved = 0;
+    if (cnt == 0) {
+        return NULL;
+    }
+    lock_release(&frame_table_lock);
+    *saved = frame_save_victims(victims, cnt);
+    lock_acquire(&frame_table_lock);
+    frame_finish_victims(victims, cnt, *saved);
+    return *saved > 0 ? victims[0] : NULL;
+}
+
+struct frame_table_entry* frame_get_used_fr(void *upage) {
+
+    size_t saved;
+    struct frame_table_entry *entry = frame_evict(&saved);
+    if (entry == NULL) {
+        return NULL;
+    }
     entry->upage=upage;
     entry->holder=thread_current();
-    list_remove(e);
-    list_push_front(&frame_list,e);
+    entry->pinned=1;
+    entry->prefetched=false;
+    frame_account(entry->holder, 1);
     return entry;
 }
+//true if the pageout thread has to be woken, the caller ups pageout_sema
+//once frame_table_lock is released
+static bool frame_pageout_needed(void) {
+    if (pageout_awake || frame_low_watermark == 0
+        || palloc_user_free_cnt() >= frame_low_watermark) {
+        return false;
+    }
+    pageout_awake = true;
+    return true;
+}
+
+//pageout thread: sleep until free user pages drop below the low watermark,
+//then evict in the background until the high watermark is reached.
+//frame_evict drops frame_table_lock during the I/O, so faults are not held up by the batch.
+static void frame_pageout(void *aux UNUSED) {
+    for (;;) {
+        sema_down(&pageout_sema);
+        frame_pageout_wake_cnt++;
+        lock_acquire(&frame_table_lock);
+        while (frame_cnt > 0 && palloc_user_free_cnt() < frame_high_watermark) {
+            size_t saved;
+            struct frame_table_entry *entry = frame_evict(&saved);
+            if (entry == NULL) {
+                break;
+            }
+            frame_release_entry(entry);
+            frame_pageout_cnt += saved;
+        }
+        pageout_awake = false;
+        lock_release(&frame_table_lock);
+    }
+}
+
+//working set of t: its resident pages that have been accessed since the clock last
+//cleared their accessed bits. must hold frame_table_lock
+static size_t frame_sample_ws(struct thread *t) {
+    size_t ws = 0;
+    for (size_t i = 0; i < frame_table_size; i++) {
+        struct frame_table_entry *entry = &frame_table[i];
+        if (entry->frame == NULL || entry->in_transit) {
+            continue;
+        }
+        if (entry->holder == t && pagedir_is_accessed(t->pagedir, entry->upage)) {
+            ws++;
+        }
+        for (struct list_elem *e = list_begin(&entry->rmap); e != list_end(&entry->rmap); e = list_next(e)) {
+            struct frame_mapping *m = list_entry(e, struct frame_mapping, elem);
+            if (m->holder == t && pagedir_is_accessed(t->pagedir, m->upage)) {
+                ws++;
+            }
+        }
+    }
+    return ws;
+}
+
+//page-fault-frequency control, on a fault of t that takes a frame.
+//intervals are counted in faults of the whole system, so they only get long when other
+//processes fault meanwhile. faulting again within frame_pff_interval means t's resident set
+//is too small and its allowance grows past it. faulting more rarely means it holds pages it
+//does not use: the allowance shrinks to its working set, and eviction prefers its other pages.
+//must hold frame_table_lock
+static void frame_pff_fault(struct thread *t) {
+    long long interval = ++frame_fault_clock - t->fault_mark;
+    t->fault_mark = frame_fault_clock;
+    if (++t->fault_cnt == 1 || frame_pff_interval == 0) {
+        return;
+    }
+    if (interval <= (long long)frame_pff_interval) {
+        if (t->frame_limit < t->rss + FRAME_PFF_STEP) {
+            t->frame_limit = t->rss + FRAME_PFF_STEP;
+            frame_pff_grow_cnt++;
+        }
+    } else {
+        t->wss = frame_sample_ws(t);
+        t->frame_limit = t->wss + FRAME_PFF_STEP > FRAME_PFF_MIN ? t->wss + FRAME_PFF_STEP : FRAME_PFF_MIN;
+        frame_pff_shrink_cnt++;
+    }
+    frame_check_over(t);
+}
+
 //get a frame from user pool, which must be mapped from upage
 //in other words, in page_table, upage->frame_get_frame(flag, upage)
 //flag is used by palloc_get_page
@@ -92,6 +563,7 @@ void* frame_get_fr(enum palloc_flags flag, void *upage) {
     ASSERT (is_user_vaddr (upage));
 
     lock_acquire(&frame_table_lock);
+    frame_pff_fault(thread_current());
     struct frame_table_entry *entry;
     void *frame = palloc_get_page(PAL_USER | flag);
     if (frame != NULL){
@@ -99,26 +571,92 @@ void* frame_get_fr(enum palloc_flags flag, void *upage) {
         if (flag == PAL_ZERO){
             memset (frame, 0, PGSIZE);
         }
-        entry=frame_create_frame_table_entry(upage,frame);
-        ASSERT(entry!=NULL && entry->frame!=NULL);
+        entry=frame_claim(upage,frame);
        //printf("thread %s insert a entry usage: %x  frame:%x\n",thread_current()->name,upage,frame);
-        list_push_front(&frame_list,&entry->le);
-        hash_insert(&frame_table, &entry->he);
+        bool wake = frame_pageout_needed();
         lock_release(&frame_table_lock);
+        if (wake) {
+            sema_up(&pageout_sema);
+        }
         //printf("get a frame from palloc:%x\n",frame);
         return frame;
     }
     //PANIC("run out of user pool and !");
+    //the pageout thread fell behind, evict on the faulting thread
+    frame_sync_evict_cnt++;
     entry=frame_get_used_fr(upage);
-        if (entry != NULL){
-            list_remove(&entry->le);
-            list_push_front(&frame_list,&entry->le);
-        }
-       //
+    bool wake = frame_pageout_needed();
     lock_release(&frame_table_lock);
+    if (wake) {
+        sema_up(&pageout_sema);
+    }
+    if (entry == NULL) {
+        return NULL;
+    }
+    if (flag & PAL_ZERO) {
+        memset (entry->frame, 0, PGSIZE);
+    }
     return entry->frame;
 }
 
+//get a free frame for read-ahead of upage, never evicts
+void* frame_get_prefetch_fr(void *upage) {
+    ASSERT (pg_ofs (upage) == 0);
+    ASSERT (is_user_vaddr (upage));
+
+    lock_acquire(&frame_table_lock);
+    void *frame = palloc_get_page(PAL_USER);
+    if (frame != NULL) {
+        struct frame_table_entry *entry=frame_claim(upage,frame);
+        entry->prefetched = true;
+        frame_prefetch_cnt++;
+    }
+    bool wake = frame_pageout_needed();
+    lock_release(&frame_table_lock);
+    if (wake) {
+        sema_up(&pageout_sema);
+    }
+    return frame;
+}
+
+//get cnt free frames, contiguous and aligned to cnt pages in physical memory, zeroed,
+//for the cnt pages from upage. never evicts.
+//return the first, NULL if the user pool has no such run, otherwise like frame_get_fr
+void* frame_get_large_fr(void *upage, size_t cnt) {
+    ASSERT (pg_ofs (upage) == 0);
+    ASSERT (is_user_vaddr (upage));
+
+    lock_acquire(&frame_table_lock);
+    uint8_t *frames = palloc_get_aligned(PAL_USER, cnt, cnt);
+    if (frames != NULL) {
+        for (size_t i = 0; i < cnt; i++) {
+            frame_claim((uint8_t *)upage + i * PGSIZE, frames + i * PGSIZE);
+        }
+        frame_pff_fault(thread_current());
+    }
+    bool wake = frame_pageout_needed();
+    lock_release(&frame_table_lock);
+    if (wake) {
+        sema_up(&pageout_sema);
+    }
+    //pinned, so they can be zeroed without the lock
+    if (frames != NULL) {
+        memset(frames, 0, cnt * PGSIZE);
+    }
+    return frames;
+}
+
+//make a frame got from frame_get_fr eligible for eviction
+void frame_unpin_fr(void *frame) {
+    ASSERT (pg_ofs (frame) == 0);
+    lock_acquire(&frame_table_lock);
+    struct frame_table_entry *entry=frame_find_entry(frame);
+    if (entry != NULL && entry->pinned > 0) {
+        entry->pinned--;
+    }
+    lock_release(&frame_table_lock);
+}
+
 //free a frame that got from frame_get_frame
 void frame_free_fr(void *frame) {
     ASSERT (pg_ofs (frame) == 0);
@@ -129,10 +667,289 @@ void frame_free_fr(void *frame) {
     if (entry != NULL) {
         if (entry->frame == NULL)
             PANIC("try_free_a frame_that_not_exist!!");
-        hash_delete(&frame_table, &entry->he);
-        list_remove(&entry->le);
-        palloc_free_page(frame);
-        free(entry);
+        frame_check_prefetch(entry);
+        frame_account(entry->holder, -1);
+        frame_release_entry(entry);
+    }
+    lock_release(&frame_table_lock);
+}
+
+//entry of frame once no eviction of it is in progress, NULL if it is not a frame (any more).
+//must hold frame_table_lock, which is released while waiting
+static struct frame_table_entry* frame_settle(void *frame) {
+    struct frame_table_entry *entry;
+    while ((entry = frame_find_entry(frame)) != NULL && entry->in_transit) {
+        cond_wait(&entry->transit, &frame_table_lock);
+    }
+    return entry;
+}
+
+//true if t maps entry at upage
+static bool frame_maps(struct frame_table_entry *entry, struct thread *t, void *upage) {
+    if (entry->holder == t && entry->upage == upage) {
+        return true;
+    }
+    for (struct list_elem *e = list_begin(&entry->rmap); e != list_end(&entry->rmap); e = list_next(e)) {
+        struct frame_mapping *m = list_entry(e, struct frame_mapping, elem);
+        if (m->holder == t && m->upage == upage) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//wait until frame is not in transit, return false at once if it was not
+bool frame_wait_fr(void *frame) {
+    ASSERT (pg_ofs (frame) == 0);
+    lock_acquire(&frame_table_lock);
+    struct frame_table_entry *entry = frame_find_entry(frame);
+    bool waited = entry != NULL && entry->in_transit;
+    frame_settle(frame);
+    lock_release(&frame_table_lock);
+    return waited;
+}
+
+//pin frame, which the current thread maps at upage, so it is not evicted until frame_unpin_fr.
+//waits out an eviction in progress, return false if that eviction took the mapping away
+bool frame_pin_fr(void *frame, void *upage) {
+    ASSERT (pg_ofs (frame) == 0);
+    lock_acquire(&frame_table_lock);
+    struct frame_table_entry *entry = frame_settle(frame);
+    bool mapped = entry != NULL && frame_maps(entry, thread_current(), upage);
+    if (mapped) {
+        entry->pinned++;
+    }
+    lock_release(&frame_table_lock);
+    return mapped;
+}
+
+//drop the mapping of entry at upage of t, the frame is freed with its last mapping,
+//or only detached and stored in *detached if that is not NULL.
+//return false if t does not map it there. must hold frame_table_lock
+static bool frame_unmap_entry(struct frame_table_entry *entry, struct thread *t, void *upage, void **detached) {
+    if (!frame_maps(entry, t, upage)) {
+        return false;
+    }
+    frame_account(t, -1);
+    if (entry->refcnt == 1) {
+        frame_check_prefetch(entry);
+        if (detached != NULL) {
+            *detached = frame_detach_entry(entry);
+        } else {
+            frame_release_entry(entry);
+        }
+    } else if (entry->holder == t && entry->upage == upage) {
+        //promote another mapping, holder's page directory is about to go away
+        struct frame_mapping *m = list_entry(list_pop_front(&entry->rmap), struct frame_mapping, elem);
+        entry->holder = m->holder;
+        entry->upage = m->upage;
+        entry->refcnt--;
+        free(m);
+    } else {
+        for (struct list_elem *e = list_begin(&entry->rmap); e != list_end(&entry->rmap); e = list_next(e)) {
+            struct frame_mapping *m = list_entry(e, struct frame_mapping, elem);
+            if (m->holder == t && m->upage == upage) {
+                list_remove(e);
+                entry->refcnt--;
+                free(m);
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+//drop the mapping of frame at upage of the current thread,
+//the frame is freed with its last mapping.
+//waits out an eviction in progress, return false if that eviction took the mapping away
+bool frame_unmap_fr(void *frame, void *upage) {
+    ASSERT (pg_ofs (frame) == 0);
+    lock_acquire(&frame_table_lock);
+    struct frame_table_entry *entry=frame_settle(frame);
+    bool mapped = entry != NULL && frame_unmap_entry(entry, thread_current(), upage, NULL);
+    lock_release(&frame_table_lock);
+    return mapped;
+}
+
+//frame_unmap_fr for cnt frames of the current thread at once, mapped[i] being the result
+//for frames[i] at upages[i]. frame_table_lock is taken once, and the frames freed go back
+//to palloc afterwards in runs of contiguous pages. frames is used as scratch space
+void frame_unmap_batch(void **frames, void **upages, bool *mapped, size_t cnt) {
+    struct thread *cur = thread_current();
+    size_t freed = 0;
+    lock_acquire(&frame_table_lock);
+    for (size_t i = 0; i < cnt; i++) {
+        ASSERT (pg_ofs (frames[i]) == 0);
+        struct frame_table_entry *entry = frame_settle(frames[i]);
+        void *detached = NULL;
+        mapped[i] = entry != NULL && frame_unmap_entry(entry, cur, upages[i], &detached);
+        if (detached != NULL) {
+            frames[freed++] = detached;
+        }
+    }
+    lock_release(&frame_table_lock);
+    for (size_t i = 0, run; i < freed; i += run) {
+        for (run = 1; i + run < freed && (uint8_t *)frames[i + run] == (uint8_t *)frames[i] + run * PGSIZE; run++) {
+            continue;
+        }
+        palloc_free_multiple(frames[i], run);
+    }
+}
+
+//publish a private read-only frame holding read_bytes of inode at file_ofs,
+//so other processes faulting on the same page can map it.
+//if another process published the page first, the frame just stays private.
+void frame_share_fr(void *frame, struct inode *inode, uint32_t file_ofs, uint32_t read_bytes) {
+    ASSERT (pg_ofs (frame) == 0);
+    ASSERT (inode != NULL);
+    lock_acquire(&frame_table_lock);
+    struct frame_table_entry *entry=frame_find_entry(frame);
+    if (entry != NULL && entry->inode == NULL) {
+        entry->inode = inode;
+        entry->file_ofs = file_ofs;
+        entry->read_bytes = read_bytes;
+        if (hash_insert(&shared_table, &entry->se) != NULL) {
+            entry->inode = NULL;
+        }
+    }
+    lock_release(&frame_table_lock);
+}
+
+//look for a published frame holding read_bytes of inode at file_ofs.
+//if found, add a mapping at upage for the current thread and return it pinned
+void* frame_get_shared_fr(struct inode *inode, uint32_t file_ofs, uint32_t read_bytes, void *upage) {
+    ASSERT (pg_ofs (upage) == 0);
+    ASSERT (is_user_vaddr (upage));
+
+    struct frame_table_entry temp_entry;
+    temp_entry.inode = inode;
+    temp_entry.file_ofs = file_ofs;
+    void *frame = NULL;
+    lock_acquire(&frame_table_lock);
+    struct hash_elem *e = hash_find(&shared_table, &temp_entry.se);
+    if (e != NULL) {
+        struct frame_table_entry *entry = hash_entry(e, struct frame_table_entry, se);
+        struct frame_mapping *m = malloc(sizeof(struct frame_mapping));
+        if (entry->read_bytes == read_bytes && m != NULL) {
+            m->holder = thread_current();
+            m->upage = upage;
+            m->locked = false;
+            list_push_back(&entry->rmap, &m->elem);
+            entry->refcnt++;
+            entry->pinned++;
+            frame_account(m->holder, 1);
+            frame = entry->frame;
+            frame_shared_hit_cnt++;
+        } else {
+            free(m);
+        }
+    }
+    lock_release(&frame_table_lock);
+    return frame;
+}
+
+//map frame, which parent has at upage, into child at the same address.
+//a writable page is write-protected in parent, the caller maps it read-only in child.
+//waits out an eviction in progress.
+//return the frame pinned, or NULL if the page is no longer resident in parent
+void* frame_fork_fr(void *frame, struct thread *parent, struct thread *child, void *upage, bool writable) {
+    ASSERT (pg_ofs (frame) == 0);
+    lock_acquire(&frame_table_lock);
+    struct frame_table_entry *entry = frame_settle(frame);
+    struct frame_mapping *m = entry != NULL && frame_maps(entry, parent, upage)
+                              ? malloc(sizeof(struct frame_mapping)) : NULL;
+    if (m == NULL) {
+        lock_release(&frame_table_lock);
+        return NULL;
+    }
+    m->holder = child;
+    m->upage = upage;
+    m->locked = false;
+    list_push_back(&entry->rmap, &m->elem);
+    entry->refcnt++;
+    entry->pinned++;
+    frame_account(child, 1);
+    if (writable) {
+        pagedir_set_writable(parent->pagedir, upage, false);
     }
     lock_release(&frame_table_lock);
-}
\ No newline at end of file
+    return frame;
+}
+
+//give the current thread a private copy of the copy-on-write frame it maps at upage.
+//a frame nobody else maps any more is handed back as is.
+//return the frame to map writable at upage, pinned, or NULL if out of frames
+//or if the page was evicted meanwhile
+void* frame_cow_fr(void *frame, void *upage) {
+    ASSERT (pg_ofs (frame) == 0);
+    struct thread *cur = thread_current();
+    lock_acquire(&frame_table_lock);
+    struct frame_table_entry *entry=frame_settle(frame);
+    if (entry == NULL || !frame_maps(entry, cur, upage)) {
+        //evicted meanwhile
+        lock_release(&frame_table_lock);
+        return NULL;
+    }
+    //keep the source while copying
+    entry->pinned++;
+    bool shared = entry->refcnt > 1;
+    lock_release(&frame_table_lock);
+    if (!shared) {
+        return frame;
+    }
+    void *copy = frame_get_fr(0, upage);
+    if (copy != NULL) {
+        memcpy(copy, frame, PGSIZE);
+        frame_cow_copy_cnt++;
+    }
+    //still pinned, so the mapping is still there
+    lock_acquire(&frame_table_lock);
+    entry->pinned--;
+    if (copy != NULL) {
+        frame_unmap_entry(entry, cur, upage, NULL);
+    }
+    lock_release(&frame_table_lock);
+    return copy;
+}
+
+//record the page usage of the current process, whose pages are all released,
+//and stop counting it as over its allowance
+void frame_exit_process(void) {
+    struct thread *cur = thread_current();
+    lock_acquire(&frame_table_lock);
+    struct frame_proc_stats *s = &frame_proc_history[frame_proc_exit_cnt++ % FRAME_PROC_HISTORY];
+    strlcpy(s->name, cur->name, sizeof s->name);
+    s->tid = cur->tid;
+    s->fault_cnt = cur->fault_cnt;
+    s->rss_peak = cur->rss_peak;
+    s->wss = cur->wss;
+    s->frame_limit = cur->frame_limit;
+    cur->frame_limit = SIZE_MAX;
+    frame_check_over(cur);
+    lock_release(&frame_table_lock);
+}
+
+//print eviction statistics and those of the last processes to exit
+void frame_print_stats(void) {
+    printf("Frame: %lld evictions, %lld clock steps, %lld clustered swap-outs\n",
+           frame_evict_cnt, frame_scan_cnt, frame_cluster_cnt);
+    printf("Frame: %lld pages read ahead, %lld used\n",
+           frame_prefetch_cnt, frame_prefetch_hit_cnt);
+    printf("Frame: %lld faults served from shared pages, %lld copy-on-write copies\n",
+           frame_shared_hit_cnt, frame_cow_copy_cnt);
+    printf("Frame: %lld pages evicted by pageout in %lld wake-ups, %lld faults evicted synchronously\n",
+           frame_pageout_cnt, frame_pageout_wake_cnt, frame_sync_evict_cnt);
+    printf("Frame: %lld allowances grown, %lld shrunk to the working set, %lld victims over their allowance\n",
+           frame_pff_grow_cnt, frame_pff_shrink_cnt, frame_over_evict_cnt);
+    size_t first = frame_proc_exit_cnt > FRAME_PROC_HISTORY ? frame_proc_exit_cnt - FRAME_PROC_HISTORY : 0;
+    for (size_t i = first; i < frame_proc_exit_cnt; i++) {
+        struct frame_proc_stats *s = &frame_proc_history[i % FRAME_PROC_HISTORY];
+        printf("Frame: %s (%d): %lld faults, peak rss %zu, working set %zu, ",
+               s->name, s->tid, s->fault_cnt, s->rss_peak, s->wss);
+        if (s->frame_limit == SIZE_MAX) {
+            printf("no allowance\n");
+        } else {
+            printf("allowance %zu\n", s->frame_limit);
+        }
+    }
+}
@@ -4,28 +4,116 @@
 #include "devices/block.h"
 #include "lib/kernel/list.h"
 #include "lib/kernel/hash.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 
+struct inode;
+
+//default free user page watermarks of the pageout thread, see -lowat and -hiwat
+#define FRAME_LOW_WATERMARK 16
+#define FRAME_HIGH_WATERMARK 32
+extern size_t frame_low_watermark;
+extern size_t frame_high_watermark;
+
+//page-fault-frequency control of per-process frame allowances, see frame_pff_fault.
+//default -pff: a process faulting again within this many faults of the whole system may grow
+#define FRAME_PFF_INTERVAL 64
+//headroom of an allowance above the resident or working set, and the smallest allowance
+#define FRAME_PFF_STEP 8
+#define FRAME_PFF_MIN 16
+extern size_t frame_pff_interval;
+
+//a further address space mapping a shared frame
+struct frame_mapping{
+    struct thread *holder;
+    void *upage;
+    bool locked;            // the eviction in progress took holder's page_table_lock
+    struct list_elem elem;
+};
+
 struct frame_table_entry{
-    void *frame;
+    void *frame;            // NULL while the user page is not a frame
     void *upage;
     struct thread* holder;
-    struct hash_elem he;
-    struct list_elem le;
+    int pinned;             // pin count, never chosen as a victim while nonzero
+    bool prefetched;        // brought in by read-ahead and not yet seen accessed
+    bool in_transit;        // being evicted, its mappings may only change once that is over
+    bool holder_locked;     // the eviction in progress took holder's page_table_lock
+    struct condition transit;   // signalled with frame_table_lock when in_transit is cleared
+    size_t refcnt;          // number of mappings, holder/upage plus one per rmap element
+    struct list rmap;       // frame_mapping of every mapping but holder/upage
+    struct inode *inode;    // with file_ofs, key in the shared-page registry, NULL if private
+    uint32_t file_ofs;
+    uint32_t read_bytes;
+    struct hash_elem se;    // element of the shared-page registry
 };
 
 void *frame_find_fr(void *frame);
-void frame_lift_fr(bool execute);
-//init frame_table
+//init frame_table and start the pageout thread
 //used in thread/init.c
 void  frame_init();
 
 //get a frame from user pool, which must be mapped from upage
 //in other words, in page_table, upage->frame_get_frame(flag, upage)
 //flag is used by palloc_get_page
+//the frame is returned pinned, call frame_unpin_fr once it is mapped
 void* frame_get_fr(enum palloc_flags flag, void *upage);
 
+//get a free frame for read-ahead of upage, never evicts
+//return NULL if the user pool is exhausted, otherwise like frame_get_fr
+void* frame_get_prefetch_fr(void *upage);
+
+//get cnt frames, contiguous and aligned to cnt pages in physical memory, for a large page
+//at upage. never evicts, return NULL if the user pool has no such run.
+//each frame is zeroed and returned pinned like one from frame_get_fr
+void* frame_get_large_fr(void *upage, size_t cnt);
+
+//make a frame got from frame_get_fr eligible for eviction
+void  frame_unpin_fr(void *frame);
+
 //free a frame that got from frame_get_frame
 void  frame_free_fr(void *frame);
 
-#endif
\ No newline at end of file
+//drop the mapping of frame at upage of the current thread,
+//the frame is freed with its last mapping.
+//waits out an eviction in progress, return false if that eviction took the mapping away
+bool  frame_unmap_fr(void *frame, void *upage);
+
+//frame_unmap_fr for cnt frames of the current thread, taking the frame table lock once.
+//mapped[i] is set to the result for frames[i] at upages[i], frames is clobbered
+void  frame_unmap_batch(void **frames, void **upages, bool *mapped, size_t cnt);
+
+//wait until frame is no longer being evicted, return false at once if it was not
+bool  frame_wait_fr(void *frame);
+
+//pin frame, which the current thread maps at upage, until frame_unpin_fr.
+//waits out an eviction in progress, return false if that eviction took the mapping away
+bool  frame_pin_fr(void *frame, void *upage);
+
+//publish a private read-only frame holding read_bytes of inode at file_ofs,
+//so other processes faulting on the same page can map it
+void  frame_share_fr(void *frame, struct inode *inode, uint32_t file_ofs, uint32_t read_bytes);
+
+//look for a published frame holding read_bytes of inode at file_ofs.
+//if found, add a mapping at upage for the current thread and return it pinned,
+//call frame_unpin_fr once it is mapped
+void* frame_get_shared_fr(struct inode *inode, uint32_t file_ofs, uint32_t read_bytes, void *upage);
+
+//map frame, which parent has at upage, into child at the same address,
+//write-protecting it in parent if writable. the frame is returned pinned,
+//return NULL if it is no longer resident
+void* frame_fork_fr(void *frame, struct thread *parent, struct thread *child, void *upage, bool writable);
+
+//give the current thread a private copy of the copy-on-write frame it maps at upage,
+//returned pinned. NULL if out of frames or if the page was evicted meanwhile
+void* frame_cow_fr(void *frame, void *upage);
+
+//record the page usage of the current process, whose pages are all released,
+//for the statistics
+void  frame_exit_process(void);
+
+//print eviction statistics and those of the last processes to exit
+void  frame_print_stats(void);
+
+#endif
@@ -3,88 +3,216 @@
 #include "frame.h"
 #include "swap.h"
 #include "threads/vaddr.h"
+#include "threads/pte.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "userprog/pagedir.h"
 #include "lib/stddef.h"
 #include "threads/malloc.h"
 #include "lib/debug.h"
-#include "lib/kernel/hash.h"
+#include "lib/string.h"
+#include "filesys/file.h"
+#include "userprog/syscall.h"
+#include <round.h>
 #define PAL_DEFAULT			0
 #define POINTER_SIZE		32
 //On many GNU/Linux systems, the default limit is 8 MB
 #define PAGE_STACK_LIMIT			0x800000
 #define PAGE_STACK_UNDERLINE	((uint32_t)PHYS_BASE - (uint32_t) PAGE_STACK_LIMIT)
+//most neighbouring pages brought in along with a swap fault
+#define PAGE_READAHEAD			(SWAP_CLUSTER - 1)
+//entries in one leaf of the page table, which covers that many consecutive user pages
+#define PAGE_LEAF_CNT			(PGSIZE / sizeof(struct page_table_entry))
+//pages mapped by one large page
+#define PAGE_LARGE_CNT			(PTSPAN / PGSIZE)
+//pages page_destroy_table gives back at a time
+#define PAGE_RELEASE_BATCH		32
+//leaves needed to cover user space
+#define PAGE_DIR_CNT			(LOADER_PHYS_BASE / PGSIZE / PAGE_LEAF_CNT)
+
+/* Supplemental page table of a process.
+ the directory is indexed by the virtual page number divided by PAGE_LEAF_CNT,
+ each leaf is one page of entries indexed by the rest of it.
+ leaves are allocated on first use and only freed with the table, a free slot has status NONE. */
+struct page_table {
+    struct page_table_entry *leaves[PAGE_DIR_CNT];
+};
+#define PAGE_DIR_PAGES			DIV_ROUND_UP(sizeof(struct page_table), PGSIZE)
+
+//called for every page of a table by page_for_each, which stops when it returns false
+typedef bool page_action_func(void *upage, struct page_table_entry *entry, void *aux);
 
 static struct lock page_table_lock;
-bool page_hash_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED);
-unsigned page_hash(const struct hash_elem *e, void* aux UNUSED);
-struct page_table_entry* page_find(struct hash *page_table, void *upage);
-void page_table_destructor(struct hash_elem *e, void *aux UNUSED);
+//mapped read-only for ZERO pages until they are first written
+static void *zero_page;
+
+//-fa: most pages mapped along with a FILE fault, 0 turns fault-around off
+size_t page_fault_around = PAGE_FAULT_AROUND;
+//-lp: map untouched 4 MB aligned zero-filled regions with one 4 MB page
+bool page_large = false;
+
+//statistics
+static long long page_zero_map_cnt;
+static long long page_zero_fill_cnt;
+static long long page_around_cnt;
+static long long page_around_used_cnt;
+static long long page_swap_cache_hit_cnt;
+static long long page_pin_cnt;
+static long long page_pin_fault_cnt;
+static long long page_large_cnt;
+static long long page_release_page_cnt;
+static long long page_release_batch_cnt;
+
+static void page_fault_around_settle(struct thread *cur);
 
 void page_init() {
     lock_init(&page_table_lock);
+    zero_page = palloc_get_page(PAL_ZERO);
+    if (zero_page == NULL)
+        PANIC("no page for the zero page");
+    if (page_fault_around > PAGE_FAULT_AROUND_MAX)
+        page_fault_around = PAGE_FAULT_AROUND_MAX;
 }
-bool page_hash_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED) {
-    return hash_entry(a, struct page_table_entry, he)->key < hash_entry(b, struct page_table_entry, he)->key;
+// slot of upage in page_table, allocating its leaf if create. NULL if there is none
+static struct page_table_entry* page_slot(struct page_table *page_table, const void *upage, bool create) {
+    uint32_t vpn = pg_no(upage);
+    struct page_table_entry **leaf = &page_table->leaves[vpn / PAGE_LEAF_CNT];
+    if(*leaf == NULL && (!create || (*leaf = palloc_get_page(PAL_ZERO)) == NULL)) {
+        return NULL;
+    }
+    return &(*leaf)[vpn % PAGE_LEAF_CNT];
 }
 
-/* hash function of element in hash table*/
-unsigned page_hash(const struct hash_elem *e, void* aux UNUSED){
-    struct page_table_entry *entry = hash_entry(e, struct page_table_entry, he);
-    return hash_bytes(&(entry->key), sizeof(entry->key));
+struct page_table_entry* page_find(struct page_table *page_table, const void *upage) {
+    ASSERT(page_table != NULL);
+    if(!is_user_vaddr(upage)) {
+        return NULL;
+    }
+    struct page_table_entry *entry = page_slot(page_table, upage, false);
+    return entry != NULL && entry->status != NONE ? entry : NULL;
 }
 
-struct page_table_entry* page_find(struct hash *page_table, void *upage) {
-    struct hash_elem *e;
-    struct page_table_entry tmp_entry;
+// claim the free slot of upage, cleared. NULL if upage is taken or out of memory
+static struct page_table_entry* page_insert(struct page_table *page_table, const void *upage) {
+    struct page_table_entry *entry = page_slot(page_table, upage, true);
+    return entry != NULL && entry->status == NONE ? entry : NULL;
+}
 
-    ASSERT(page_table != NULL);
-    tmp_entry.key = upage;
-    e = hash_find(page_table, &(tmp_entry.he));
-    return e!=NULL?hash_entry(e,struct page_table_entry,he):NULL;
+// free the slot of entry
+static void page_remove(struct page_table_entry *entry) {
+    memset(entry, 0, sizeof *entry);
 }
 
-struct hash* page_create_table() {
-    struct hash* page_table= (struct hash*)malloc(sizeof(struct hash));
-    hash_init(page_table, page_hash, page_hash_less, NULL);
-    return page_table;
+// call action on every page of page_table in address order, skipping missing leaves whole
+static bool page_for_each(struct page_table *page_table, page_action_func *action, void *aux) {
+    for(uint32_t i = 0; i < PAGE_DIR_CNT; i++) {
+        struct page_table_entry *leaf = page_table->leaves[i];
+        if(leaf == NULL) {
+            continue;
+        }
+        for(uint32_t j = 0; j < PAGE_LEAF_CNT; j++) {
+            void *upage = (void *)((i * PAGE_LEAF_CNT + j) * PGSIZE);
+            if(leaf[j].status != NONE && !action(upage, &leaf[j], aux)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+struct page_table* page_create_table() {
+    return palloc_get_multiple(PAL_ZERO, PAGE_DIR_PAGES);
 }
 
 /* Second, the kernel consults the supplemental page table
- when a process terminates, to decide what resources to free. */
+ when a process terminates, to decide what resources to free.
+ they are given back a batch at a time, so that the page directory, the frame table
+ and the swap map are each locked and flushed once per batch rather than once per page. */
+struct page_release_batch {
+    void *upages[PAGE_RELEASE_BATCH];   // mapped pages, cleared in the page directory
+    size_t upage_cnt;
+    struct page_table_entry *entries[PAGE_RELEASE_BATCH];  // resident pages among them
+    void *kpages[PAGE_RELEASE_BATCH];   // and their frames
+    void *frame_upages[PAGE_RELEASE_BATCH];
+    size_t frame_cnt;
+    block_sector_t slots[PAGE_RELEASE_BATCH];   // swap slots to free
+    size_t slot_cnt;
+};
+
+static void page_release_slot(struct page_release_batch *b, block_sector_t slot) {
+    if(b->slot_cnt == PAGE_RELEASE_BATCH) {
+        swap_free_batch(b->slots, b->slot_cnt);
+        b->slot_cnt = 0;
+    }
+    b->slots[b->slot_cnt++] = slot;
+}
 
-void page_table_destructor(struct hash_elem *e, void *aux UNUSED) {
-    struct page_table_entry *entry = hash_entry(e, struct page_table_entry, he);
-    if(entry->status==SWAP){
+static void page_release_flush(struct thread *cur, struct page_release_batch *b) {
+    bool mapped[PAGE_RELEASE_BATCH];
+    pagedir_clear_pages(cur->pagedir, b->upages, b->upage_cnt);
+    frame_unmap_batch(b->kpages, b->frame_upages, mapped, b->frame_cnt);
+    for(size_t i = 0; i < b->frame_cnt; i++) {
+        struct page_table_entry *entry = b->entries[i];
+        if(mapped[i]) {
+            if(entry->swap_cached) {
+                page_release_slot(b, entry->swap_slot);
+            }
+        }else if(entry->status == SWAP && entry->val != (uint32_t)-1) {
+            // an eviction got to the page first, it is in swap now
+            page_release_slot(b, entry->val);
+        }
+    }
+    swap_free_batch(b->slots, b->slot_cnt);
+    page_release_page_cnt += b->upage_cnt;
+    page_release_batch_cnt++;
+    b->upage_cnt = b->frame_cnt = b->slot_cnt = 0;
+}
+
+static bool page_release(void *upage, struct page_table_entry *entry, void *aux) {
+    struct page_release_batch *b = aux;
+    if(entry->status==FRAME){
+        b->upages[b->upage_cnt++] = upage;
+        if(entry->val != 0) {
+            b->entries[b->frame_cnt] = entry;
+            b->kpages[b->frame_cnt] = (void*)entry->val;
+            b->frame_upages[b->frame_cnt++] = upage;
+        }else if(entry->swap_cached) {
+            page_release_slot(b, entry->swap_slot);
+        }
+    }
+    else if(entry->status==SWAP){
         uint32_t index=entry->val;
         if(index!=-1) {
-            swap_free_swap_slot(index);
+            page_release_slot(b, index);
         }
     }
-    else if(entry->status==FRAME){
-        pagedir_clear_page(thread_current()->pagedir, entry->key);
-        void* kpage=(void*)entry->val;
-        if(kpage!=NULL)
-            frame_free_fr(kpage);
+    else if(entry->status==ZERO){
+        // the zero page must not be freed with the page directory
+        b->upages[b->upage_cnt++] = upage;
+    }
+    if(b->upage_cnt == PAGE_RELEASE_BATCH) {
+        page_release_flush(thread_current(), b);
     }
-    free(entry);
+    return true;
 }
 
 bool page_install_demand_page(void *upage, uint32_t cur_ofs, uint32_t page_read_bytes, bool writable) {
     struct thread *cur = thread_current();
-    struct hash* page_table = cur->page_table;
     lock_acquire(&cur->page_table_lock);
-    struct page_table_entry* entry = page_find(page_table, upage);
-    if(entry == NULL && upage < PAGE_STACK_UNDERLINE) {
-        entry = malloc(sizeof(struct page_table_entry));
-        entry->key = upage;
+    struct page_table_entry* entry = NULL;
+    if(upage < (void*)PAGE_STACK_UNDERLINE) {
+        entry = page_insert(cur->page_table, upage);
+    }
+    if(entry != NULL) {
         entry->val = cur_ofs;
         entry->page_read_bytes = page_read_bytes;
         entry->status = FILE;
         entry->writable = writable;
+        entry->from_file = true;
+        entry->file_ofs = cur_ofs;
+        entry->file = NULL;
+        entry->cow = false;
         //printf("thread %s try to install_demand_page to page table: offset %x  and upage is:%x\n",cur->name,cur_ofs,upage);
-        hash_insert(page_table, &entry->he);
         lock_release(&cur->page_table_lock);
         return true;
     }
@@ -96,21 +224,165 @@ bool page_install_demand_page(void *upage, uint32_t cur_ofs, uint32_t page_read_
 
 
 
-bool page_evict_upage(struct thread *holder, void *upage, uint32_t index){
+/* Write a resident mmap page back to its file.
+ the inode and free map do their own locking, so this does not take the file system lock
+ and is safe from the eviction path. */
+static void page_write_back(struct page_table_entry *entry, void *kpage){
+    file_write_at(entry->file, kpage, entry->page_read_bytes, entry->file_ofs);
+}
+
+// a swap_cached page about to be written elsewhere gives up its old slot
+static void page_drop_swap_cache(struct page_table_entry *entry){
+    if(entry->swap_cached) {
+        swap_free_swap_slot(entry->swap_slot);
+        entry->swap_cached = false;
+    }
+}
+
+/* Unmap upage of holder and save its frame so it can be faulted back in.
+ A page that still matches its copy in the executable is just dropped and goes back to FILE,
+ an mmap page goes back to MMAP after writing it to its file if dirty,
+ a page read from swap and not written since goes back to its old slot,
+ anything else is written to swap.
+ The evicting thread holds holder->page_table_lock, so holder sees the entry either before or after. */
+bool page_evict_upage(struct thread *holder, void *upage){
     struct page_table_entry* entry= page_find(holder->page_table, upage);
     if(entry == NULL || entry->status != FRAME) {
         return false;
     }
+    void *kpage = (void*)entry->val;
+    // unmap before looking at the dirty bit, so holder can not write the page behind our back.
+    // pagedir_clear_page keeps the dirty bit of the pte.
+    pagedir_clear_page(holder->pagedir, upage);
+    bool dirty = pagedir_is_dirty(holder->pagedir, upage);
+    bool cow = entry->cow;
+    // whatever is saved below is this process' own copy
+    entry->cow = false;
+    if(entry->file != NULL) {
+        if(dirty) {
+            page_write_back(entry, kpage);
+        }
+        entry->val = entry->file_ofs;
+        entry->status = MMAP;
+        return true;
+    }
+    if(entry->from_file && !dirty) {
+        entry->val = entry->file_ofs;
+        entry->status = FILE;
+        return true;
+    }
+    if(entry->swap_cached && !dirty) {
+        // unchanged since it was read from swap, its slot still holds it
+        entry->swap_cached = false;
+        entry->val = entry->swap_slot;
+        entry->status = SWAP;
+        page_swap_cache_hit_cnt++;
+        return true;
+    }
+    block_sector_t index = swap_store(kpage);
+    if (index == (block_sector_t)-1) {
+        entry->cow = cow;
+        pagedir_set_page(holder->pagedir, upage, kpage, entry->writable && !cow);
+        pagedir_set_dirty(holder->pagedir, upage, dirty);
+        return false;
+    }
+    page_drop_swap_cache(entry);
+    // once written, the page no longer matches the executable
+    entry->from_file = false;
     entry->val = index;
     entry->status = SWAP;
-    pagedir_clear_page(holder->pagedir, upage);
     return true;
 }
 
+// true if upage of holder is resident and can only be saved by writing it to swap
+bool page_needs_swap(struct thread *holder, void *upage){
+    struct page_table_entry* entry= page_find(holder->page_table, upage);
+    return entry != NULL && entry->status == FRAME && entry->file == NULL
+           && (pagedir_is_dirty(holder->pagedir, upage) || (!entry->from_file && !entry->swap_cached));
+}
+
+/* Evict cnt consecutive pages of holder starting at upage to one run of contiguous swap slots,
+ so they go out in one pass over the disk and can be read back together.
+ every page must satisfy page_needs_swap. return false, leaving all pages mapped,
+ if no run of cnt free slots exists. */
+bool page_evict_cluster(struct thread *holder, void *upage, size_t cnt){
+    struct page_table_entry* entries[SWAP_CLUSTER];
+    void *kpages[SWAP_CLUSTER];
+    bool dirty[SWAP_CLUSTER];
+    ASSERT(cnt > 0 && cnt <= SWAP_CLUSTER);
+    for(size_t i = 0; i < cnt; i++) {
+        void *page = (uint8_t *)upage + i * PGSIZE;
+        entries[i] = page_find(holder->page_table, page);
+        ASSERT(entries[i] != NULL && entries[i]->status == FRAME);
+        kpages[i] = (void*)entries[i]->val;
+        pagedir_clear_page(holder->pagedir, page);
+        dirty[i] = pagedir_is_dirty(holder->pagedir, page);
+    }
+    block_sector_t index = swap_store_cluster(kpages, cnt);
+    if (index == (block_sector_t)-1) {
+        for(size_t i = 0; i < cnt; i++) {
+            void *page = (uint8_t *)upage + i * PGSIZE;
+            pagedir_set_page(holder->pagedir, page, kpages[i], entries[i]->writable && !entries[i]->cow);
+            pagedir_set_dirty(holder->pagedir, page, dirty[i]);
+        }
+        return false;
+    }
+    for(size_t i = 0; i < cnt; i++) {
+        page_drop_swap_cache(entries[i]);
+        entries[i]->from_file = false;
+        entries[i]->cow = false;
+        entries[i]->val = index + i * (PGSIZE / BLOCK_SECTOR_SIZE);
+        entries[i]->status = SWAP;
+    }
+    return true;
+}
+
+/* After a swap fault on upage, bring in the swapped pages next to it as well,
+ first going up and then down, while free frames last. The frames are marked as prefetched
+ so frame.c can tell whether read-ahead paid off. Must hold cur->page_table_lock. */
+static void page_swap_readahead(struct thread *cur, void *upage){
+    size_t budget = PAGE_READAHEAD;
+    for(int dir = 1; dir >= -1; dir -= 2) {
+        for(uint32_t i = 1; budget > 0; i++) {
+            uint32_t next = (uint32_t)upage + dir * (int32_t)(i * PGSIZE);
+            if(next < PGSIZE || !is_user_vaddr((void*)next)) {
+                break;
+            }
+            struct page_table_entry* entry = page_find(cur->page_table, (void*)next);
+            if(entry == NULL || entry->status != SWAP) {
+                break;
+            }
+            void *kpage = frame_get_prefetch_fr((void*)next);
+            if(kpage == NULL) {
+                return;
+            }
+            swap_load_cached(entry->val, kpage);
+            entry->swap_slot = entry->val;
+            entry->swap_cached = true;
+            entry->val = (uint32_t)kpage;
+            entry->status = FRAME;
+            pagedir_set_page(cur->pagedir, (void*)next, kpage, entry->writable);
+            frame_unpin_fr(kpage);
+            budget--;
+        }
+    }
+}
+
 // called in thread_exit?
-void page_destroy_table(struct hash* page_table) {
+void page_destroy_table(struct page_table* page_table) {
     lock_acquire(&thread_current()->page_table_lock);
-    hash_destroy(page_table, page_table_destructor);
+    struct page_release_batch batch;
+    batch.upage_cnt = batch.frame_cnt = batch.slot_cnt = 0;
+    page_fault_around_settle(thread_current());
+    page_for_each(page_table, page_release, &batch);
+    page_release_flush(thread_current(), &batch);
+    frame_exit_process();
+    for(uint32_t i = 0; i < PAGE_DIR_CNT; i++) {
+        if(page_table->leaves[i] != NULL) {
+            palloc_free_page(page_table->leaves[i]);
+        }
+    }
+    palloc_free_multiple(page_table, PAGE_DIR_PAGES);
     lock_release(&thread_current()->page_table_lock);
 }
 
@@ -123,21 +395,21 @@ void page_destroy_table(struct hash* page_table) {
  address, then map our page there. */
 bool page_set_frame(void *upage, void *kpage, bool writable) {
     struct thread *cur = thread_current();
-    struct hash* page_table = cur->page_table;
     uint32_t *pagedir = cur->pagedir;
     ASSERT(kpage!=NULL)
     lock_acquire(&thread_current()->page_table_lock);
-    struct page_table_entry* entry = page_find(page_table, upage);
-    if(entry == NULL) {
-        entry = malloc(sizeof(struct page_table_entry));
-        entry->key = upage;
+    struct page_table_entry* entry = page_insert(cur->page_table, upage);
+    if(entry != NULL) {
         entry->val = (uint32_t)kpage;
         entry->status = FRAME;
         entry->writable = writable;
+        entry->from_file = false;
+        entry->file = NULL;
+        entry->cow = false;
         //printf("thread %s try to insert a kpage to page table:%x  and upage is:%x\n",cur->name,kpage,upage);
-        hash_insert(page_table, &entry->he);
 
-        ASSERT(pagedir_set_page(pagedir, entry->key, (void*)entry->val, entry->writable));
+        ASSERT(pagedir_set_page(pagedir, upage, (void*)entry->val, entry->writable));
+        frame_unpin_fr(kpage);
         lock_release(&thread_current()->page_table_lock);
         return true;
     }
@@ -146,65 +418,280 @@ bool page_set_frame(void *upage, void *kpage, bool writable) {
 }
 
 
+/* Give cur its own writable copy of a page it shares copy-on-write,
+ on the first write to it. the frame is copied only if another process still maps it. */
+static bool page_break_cow(struct thread *cur, void *upage, struct page_table_entry *entry){
+    void *kpage = frame_cow_fr((void*)entry->val, upage);
+    if(kpage == NULL) {
+        // if the page was evicted meanwhile, the write faults again and brings it back
+        return entry->status != FRAME;
+    }
+    bool dirty = pagedir_is_dirty(cur->pagedir, upage);
+    pagedir_clear_page(cur->pagedir, upage);
+    entry->val = (uint32_t)kpage;
+    entry->cow = false;
+    pagedir_set_page(cur->pagedir, upage, kpage, true);
+    pagedir_set_dirty(cur->pagedir, upage, dirty);
+    frame_unpin_fr(kpage);
+    return true;
+}
+
+/* Count the pages the last fault-around of cur mapped that have been accessed since,
+ and size its next window on that: doubled up to page_fault_around if all were used,
+ halved if fewer than half were. Must hold cur->page_table_lock. */
+static void page_fault_around_settle(struct thread *cur){
+    size_t used = 0;
+    for(size_t i = 0; i < cur->around_cnt; i++) {
+        void *page = (uint8_t *)cur->around_start + i * PGSIZE;
+        struct page_table_entry *entry = page_find(cur->page_table, page);
+        if(entry != NULL && entry->status == FRAME && pagedir_is_accessed(cur->pagedir, page)) {
+            used++;
+        }
+    }
+    page_around_used_cnt += used;
+    if(cur->around_window == 0) {
+        cur->around_window = page_fault_around;
+    }else if(cur->around_cnt == 0) {
+        // no window to learn from
+    }else if(used == cur->around_cnt) {
+        cur->around_window = cur->around_window * 2 < page_fault_around ? cur->around_window * 2 : page_fault_around;
+    }else if(used * 2 < cur->around_cnt && cur->around_window > 1) {
+        cur->around_window /= 2;
+    }
+    cur->around_cnt = 0;
+}
+
+/* Fault-around: read the FILE page entry of upage into kpage together with the FILE pages that
+ follow it in the same segment, in one file_read_at through a bounce buffer, and map those.
+ the window ends at the first page that is not a not-yet-present FILE page continuing the
+ file contiguously, after a partial page, or once no free frame is left. a read-only page some
+ process already shared also ends it, and gets that frame mapped instead of a copy.
+ return false, having read nothing, if there is no neighbour to read. Must hold cur->page_table_lock. */
+static bool page_fault_around_read(struct thread *cur, void *upage, struct page_table_entry *entry, void *kpage){
+    struct page_table_entry *entries[PAGE_FAULT_AROUND_MAX + 1];
+    void *kpages[PAGE_FAULT_AROUND_MAX + 1];
+    size_t cnt = 1;
+    uint32_t bytes = entry->page_read_bytes;
+    struct inode *inode = file_get_inode(cur->exec_file);
+    page_fault_around_settle(cur);
+    entries[0] = entry;
+    kpages[0] = kpage;
+    while(cnt <= cur->around_window && entries[cnt - 1]->page_read_bytes == PGSIZE) {
+        void *page = (uint8_t *)upage + cnt * PGSIZE;
+        struct page_table_entry *next = is_user_vaddr(page) ? page_find(cur->page_table, page) : NULL;
+        if(next == NULL || next->status != FILE || next->page_read_bytes == 0
+           || next->writable != entry->writable || next->val != entry->val + cnt * PGSIZE) {
+            break;
+        }
+        void *shared = entry->writable ? NULL : frame_get_shared_fr(inode, next->val, next->page_read_bytes, page);
+        if(shared != NULL) {
+            // another process already has this page in memory, map its frame and stop reading there
+            next->val = (uint32_t)shared;
+            next->status = FRAME;
+            pagedir_set_page(cur->pagedir, page, shared, false);
+            frame_unpin_fr(shared);
+            break;
+        }
+        if((kpages[cnt] = frame_get_prefetch_fr(page)) == NULL) {
+            break;
+        }
+        entries[cnt] = next;
+        bytes += next->page_read_bytes;
+        cnt++;
+    }
+    uint8_t *buffer = cnt > 1 ? palloc_get_multiple(PAL_DEFAULT, cnt) : NULL;
+    if(buffer == NULL) {
+        for(size_t i = 1; i < cnt; i++) {
+            frame_free_fr(kpages[i]);
+        }
+        return false;
+    }
+    file_lock();
+    file_read_at(cur->exec_file, buffer, bytes, entry->val);
+    file_unlock();
+    for(size_t i = 0; i < cnt; i++) {
+        void *page = (uint8_t *)upage + i * PGSIZE;
+        memcpy(kpages[i], buffer + i * PGSIZE, entries[i]->page_read_bytes);
+        memset((uint8_t *)kpages[i] + entries[i]->page_read_bytes, 0, PGSIZE - entries[i]->page_read_bytes);
+        if(!entries[i]->writable) {
+            frame_share_fr(kpages[i], inode, entries[i]->val, entries[i]->page_read_bytes);
+        }
+        if(i > 0) {
+            entries[i]->val = (uint32_t)kpages[i];
+            entries[i]->status = FRAME;
+            pagedir_set_page(cur->pagedir, page, kpages[i], entries[i]->writable);
+            frame_unpin_fr(kpages[i]);
+        }
+    }
+    palloc_free_multiple(buffer, cnt);
+    cur->around_start = (uint8_t *)upage + PGSIZE;
+    cur->around_cnt = cnt - 1;
+    page_around_cnt += cnt - 1;
+    return true;
+}
+
+// true if upage of cur would read as zeros and has never been mapped
+static bool page_is_untouched_zero(struct thread *cur, void *upage) {
+    struct page_table_entry *entry = page_find(cur->page_table, upage);
+    return entry != NULL && entry->writable && pagedir_get_page(cur->pagedir, upage) == NULL
+           && (entry->status == ZERO || (entry->status == FILE && entry->page_read_bytes == 0));
+}
+
+/* Back the whole 4 MB aligned region around upage with one large page, if every page of it
+ is writable, reads as zeros and has never been mapped, as in a big bss array.
+ the frames are still tracked one by one, so eviction or a permission change of one of them
+ splits the mapping back into 4 kB pages. return false, having done nothing, if the region
+ does not qualify or the user pool has no aligned run of free frames. Must hold cur->page_table_lock. */
+static bool page_map_large(struct thread *cur, void *upage) {
+    uint8_t *base = (uint8_t *)((uintptr_t)upage & ~(uintptr_t)(PTSPAN - 1));
+    for(size_t i = 0; i < PAGE_LARGE_CNT; i++) {
+        if(!page_is_untouched_zero(cur, base + i * PGSIZE)) {
+            return false;
+        }
+    }
+    uint8_t *kpage = frame_get_large_fr(base, PAGE_LARGE_CNT);
+    if(kpage == NULL) {
+        return false;
+    }
+    if(!pagedir_set_large_page(cur->pagedir, base, kpage, true)) {
+        for(size_t i = 0; i < PAGE_LARGE_CNT; i++) {
+            frame_free_fr(kpage + i * PGSIZE);
+        }
+        return false;
+    }
+    for(size_t i = 0; i < PAGE_LARGE_CNT; i++) {
+        struct page_table_entry *entry = page_find(cur->page_table, base + i * PGSIZE);
+        entry->val = (uint32_t)(kpage + i * PGSIZE);
+        entry->status = FRAME;
+        frame_unpin_fr(kpage + i * PGSIZE);
+    }
+    page_large_cnt++;
+    return true;
+}
+
 // todo
 bool page_fault_handler(const void *vaddr, bool writable, void *esp) {
 
     struct thread *cur = thread_current();
-    struct hash* page_table = cur->page_table;
+    struct page_table* page_table = cur->page_table;
     uint32_t *pagedir = cur->pagedir;
     void *upage = pg_round_down(vaddr);
 
     bool success = false;
+    bool from_swap = false;
     lock_acquire(&cur->page_table_lock);
 
     struct page_table_entry* entry = page_find(page_table, upage);
+    // a resident page that is not mapped is being evicted, let that finish and see what it became
+    while(entry != NULL && entry->status == FRAME && pagedir_get_page(pagedir, upage) == NULL
+          && frame_wait_fr((void*)entry->val)) {
+        continue;
+    }
 
     if(writable == true && entry != NULL && entry->writable == false) {
+        lock_release(&cur->page_table_lock);
         return false;
     }
+    if(writable && entry != NULL && entry->status == FRAME && entry->cow) {
+        success = page_break_cow(cur, upage, entry);
+        lock_release(&cur->page_table_lock);
+        return success;
+    }
+    if(entry != NULL && entry->status == FRAME) {
+        // mapped again after an eviction that failed, or being evicted once more: fault again
+        success = pagedir_get_page(pagedir, upage) != NULL || frame_wait_fr((void*)entry->val);
+        lock_release(&cur->page_table_lock);
+        return success;
+    }
+
+    if(entry == NULL && upage >= (void*)PAGE_STACK_UNDERLINE
+       && vaddr >= (void*)((unsigned int)(esp) - POINTER_SIZE)) {
+        // stack growth, the new page reads as zeros until first written
+        entry = page_insert(page_table, upage);
+        if(entry != NULL) {
+            entry->val = 0;
+            entry->status = ZERO;
+            entry->page_read_bytes = 0;
+            entry->writable = true;
+            entry->from_file = false;
+            entry->file_ofs = 0;
+            entry->file = NULL;
+            entry->cow = false;
+        }
+    }
+    if(entry != NULL && entry->status == FILE && entry->page_read_bytes == 0) {
+        // bss page of the executable, there is nothing to read
+        entry->status = ZERO;
+    }
 
     void *kpage = NULL;
     if(entry == NULL) {
-        if(upage >= (void*)PAGE_STACK_UNDERLINE && vaddr >= (void*)((unsigned int)(esp) - POINTER_SIZE)) {
-            kpage = frame_get_fr(PAL_DEFAULT, upage);
-            // if get a frame from user pool
-            if(kpage != NULL) {
-                entry = malloc(sizeof(struct page_table_entry));
-                entry->key = upage;
-                entry->val = (uint32_t)kpage;
-                entry->status = FRAME;
-                entry->writable = writable;
-                hash_insert(page_table, &entry->he);
-                success=true;
+        // not a page of this process
+    }else if(entry->status == ZERO) {
+        if(page_large && page_map_large(cur, upage)) {
+            lock_release(&cur->page_table_lock);
+            return true;
+        }
+        if(!writable) {
+            // share the zero page until the first write
+            if(pagedir_get_page(pagedir, upage) == NULL) {
+                pagedir_set_page(pagedir, upage, zero_page, false);
             }
+            page_zero_map_cnt++;
+            lock_release(&cur->page_table_lock);
+            return true;
+        }
+        kpage = frame_get_fr(PAL_ZERO, upage);
+        if(kpage != NULL) {
+            pagedir_clear_page(pagedir, upage);
+            entry->val = (uint32_t)kpage;
+            entry->status = FRAME;
+            page_zero_fill_cnt++;
+            success=true;
         }
-
     }else if(entry->status==SWAP) {
         kpage = frame_get_fr(PAL_DEFAULT, upage);
         if(kpage != NULL) {
-            swap_load( entry->val, kpage);
+            swap_load_cached(entry->val, kpage);
+            entry->swap_slot = entry->val;
+            entry->swap_cached = true;
             entry->val =(uint32_t) kpage;
             entry->status = FRAME;
             success=true;
+            from_swap=true;
+        }
+    }else if (entry->status == FILE || entry->status == MMAP) {
+        // read-only pages of the executable are shared by every process running it
+        struct file *file = entry->status == MMAP ? entry->file : cur->exec_file;
+        struct inode *inode = file_get_inode(file);
+        if (entry->status == FILE && !entry->writable) {
+            kpage = frame_get_shared_fr(inode, entry->val, entry->page_read_bytes, upage);
         }
-    }else if (entry->status == FILE) {
-        kpage = frame_get_fr(PAL_DEFAULT, upage);
         if (kpage != NULL) {
+            entry->val = (uint32_t) kpage;
+            entry->status = FRAME;
+            success = true;
+        } else if ((kpage = frame_get_fr(PAL_DEFAULT, upage)) != NULL) {
             int32_t offset = (int32_t) entry->val;
             //printf("demand paging___\n");
 
-            //acquire_filesys_lock();
-            acquire_filesys_lock();
-            file_read_at(cur->exec_file, kpage, entry->page_read_bytes, offset);
-            release_filesys_lock();
-            //release_filesys_lock();
-            //printf("demand paging____readpage__%x__\n", entry->page_read_bytes);
-            if (PGSIZE > entry->page_read_bytes) {
-                memset((void *) ((uint32_t) kpage + entry->page_read_bytes), 0,
-                       PGSIZE - entry->page_read_bytes);
-                //printf("demand paging____setzero____\n");
+            if (entry->status == FILE && page_fault_around_read(cur, upage, entry, kpage)) {
+                // read along with the pages that follow it
+            } else {
+                file_lock();
+                file_read_at(file, kpage, entry->page_read_bytes, offset);
+                file_unlock();
+                //printf("demand paging____readpage__%x__\n", entry->page_read_bytes);
+                if (PGSIZE > entry->page_read_bytes) {
+                    memset((void *) ((uint32_t) kpage + entry->page_read_bytes), 0,
+                           PGSIZE - entry->page_read_bytes);
+                    //printf("demand paging____setzero____\n");
+                }
+                //printf("_____demand paging_____upage_%x__\n",pg_round_down(upage));
+                if (entry->status == FILE && !entry->writable) {
+                    frame_share_fr(kpage, inode, offset, entry->page_read_bytes);
+                }
             }
-            //printf("_____demand paging_____upage_%x__\n",pg_round_down(upage));
             entry->val = (uint32_t) kpage;
             entry->status = FRAME;
             //printf("demand paging_kpage:%x___end____\n",kpage);
@@ -218,9 +705,274 @@ bool page_fault_handler(const void *vaddr, bool writable, void *esp) {
    address KPAGE.*/
     if(success) {
         pagedir_set_page (pagedir, upage, kpage,entry->writable);
+        frame_unpin_fr(kpage);
+        if(from_swap) {
+            page_swap_readahead(cur, upage);
+        }
     }
     lock_release(&cur->page_table_lock);
     return success;
 }
 
+/* Fault upage of cur in, writable if write, and pin its frame.
+ the zero page is never evicted, a read-only mapping of it is left unpinned.
+ return false if upage is not a page of cur or may not be written. */
+static bool page_pin_page(struct thread *cur, void *upage, bool write) {
+    for(;;) {
+        lock_acquire(&cur->page_table_lock);
+        struct page_table_entry *entry = page_find(cur->page_table, upage);
+        void *kpage = pagedir_get_page(cur->pagedir, upage);
+        bool pinned = false;
+        if(entry != NULL && kpage != NULL && (!write || (entry->writable && !entry->cow))) {
+            if(kpage == zero_page) {
+                pinned = !write;
+            }else if(entry->status == FRAME) {
+                // false if an eviction took it away meanwhile, then fault it in again
+                pinned = frame_pin_fr(kpage, upage);
+            }
+        }
+        lock_release(&cur->page_table_lock);
+        if(pinned) {
+            page_pin_cnt++;
+            return true;
+        }
+        page_pin_fault_cnt++;
+        if(!page_fault_handler(upage, write, cur->esp)) {
+            return false;
+        }
+    }
+}
+
+//unpin what page_pin_page pinned at upage of cur
+static void page_unpin_page(struct thread *cur, void *upage) {
+    lock_acquire(&cur->page_table_lock);
+    void *kpage = pagedir_get_page(cur->pagedir, upage);
+    if(kpage != NULL && kpage != zero_page) {
+        frame_unpin_fr(kpage);
+    }
+    lock_release(&cur->page_table_lock);
+}
+
+/* Fault in and pin every page of size bytes at uaddr, so that the kernel can read them,
+ or write them if write, without faulting until page_unpin_range.
+ return false, with nothing pinned, if one of them is not a page the process may access so. */
+bool page_pin_range(const void *uaddr, size_t size, bool write) {
+    struct thread *cur = thread_current();
+    if(size == 0) {
+        return true;
+    }
+    uint8_t *first = pg_round_down(uaddr);
+    uint8_t *last = pg_round_down((const uint8_t *)uaddr + size - 1);
+    for(uint8_t *upage = first; upage <= last; upage += PGSIZE) {
+        if(!is_user_vaddr(upage) || !page_pin_page(cur, upage, write)) {
+            while(upage > first) {
+                upage -= PGSIZE;
+                page_unpin_page(cur, upage);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+//unpin the pages pinned by page_pin_range with the same uaddr and size
+void page_unpin_range(const void *uaddr, size_t size) {
+    struct thread *cur = thread_current();
+    if(size == 0) {
+        return;
+    }
+    uint8_t *last = pg_round_down((const uint8_t *)uaddr + size - 1);
+    for(uint8_t *upage = pg_round_down(uaddr); upage <= last; upage += PGSIZE) {
+        page_unpin_page(cur, upage);
+    }
+}
+
+/* Pin the pages of the string at str for reading, up to and including its terminator.
+ return its size with the terminator, to be passed to page_unpin_range,
+ or 0 with nothing pinned if it runs into a page the process may not read. */
+size_t page_pin_string(const char *str) {
+    struct thread *cur = thread_current();
+    const char *p = str;
+    for(;;) {
+        void *upage = pg_round_down(p);
+        if(!is_user_vaddr(upage) || !page_pin_page(cur, upage, false)) {
+            page_unpin_range(str, (const char *)upage - str);
+            return 0;
+        }
+        for(const char *end = (const char *)upage + PGSIZE; p < end; p++) {
+            if(*p == '\0') {
+                return p - str + 1;
+            }
+        }
+    }
+}
+
+/* Map length bytes of file at addr, one MMAP page per page of the file,
+ the tail of the last page reads as zeros. every page must be free and below the stack.
+ return the new mapping id or -1. */
+int page_mmap(struct file *file, void *addr, uint32_t length) {
+    struct thread *cur = thread_current();
+    size_t page_cnt = DIV_ROUND_UP(length, PGSIZE);
+    struct page_mmap_region *region = malloc(sizeof(struct page_mmap_region));
+    if(region == NULL || length == 0 || addr == NULL || pg_ofs(addr) != 0) {
+        free(region);
+        return -1;
+    }
+    lock_acquire(&cur->page_table_lock);
+    for(size_t i = 0; i < page_cnt; i++) {
+        void *upage = (uint8_t *)addr + i * PGSIZE;
+        if(upage >= (void*)PAGE_STACK_UNDERLINE || page_find(cur->page_table, upage) != NULL) {
+            lock_release(&cur->page_table_lock);
+            free(region);
+            return -1;
+        }
+    }
+    for(size_t i = 0; i < page_cnt; i++) {
+        struct page_table_entry *entry = page_insert(cur->page_table, (uint8_t *)addr + i * PGSIZE);
+        uint32_t ofs = i * PGSIZE;
+        if(entry == NULL) {
+            // out of memory for a leaf, drop the pages claimed so far
+            while(i-- > 0) {
+                page_remove(page_find(cur->page_table, (uint8_t *)addr + i * PGSIZE));
+            }
+            lock_release(&cur->page_table_lock);
+            free(region);
+            return -1;
+        }
+        entry->val = ofs;
+        entry->page_read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+        entry->status = MMAP;
+        entry->writable = true;
+        entry->from_file = false;
+        entry->file_ofs = ofs;
+        entry->file = file;
+        entry->cow = false;
+    }
+    region->id = cur->next_mapid++;
+    region->file = file;
+    region->addr = addr;
+    region->page_cnt = page_cnt;
+    list_push_back(&cur->mmap_list, &region->elem);
+    lock_release(&cur->page_table_lock);
+    return region->id;
+}
+
+// write back the dirty pages of region, drop its pages and close its file
+static void page_unmap_region(struct thread *cur, struct page_mmap_region *region) {
+    lock_acquire(&cur->page_table_lock);
+    for(size_t i = 0; i < region->page_cnt; i++) {
+        void *upage = (uint8_t *)region->addr + i * PGSIZE;
+        struct page_table_entry *entry = page_find(cur->page_table, upage);
+        ASSERT(entry != NULL && entry->file == region->file);
+        // pinned so no eviction writes it back or hands the frame over meanwhile,
+        // if one got to it first the page is already back in its file
+        void *kpage = (void*)entry->val;
+        if(entry->status == FRAME && frame_pin_fr(kpage, upage)) {
+            pagedir_clear_page(cur->pagedir, upage);
+            if(pagedir_is_dirty(cur->pagedir, upage)) {
+                page_write_back(entry, kpage);
+            }
+            frame_unmap_fr(kpage, upage);
+        }
+        page_remove(entry);
+    }
+    lock_release(&cur->page_table_lock);
+    list_remove(&region->elem);
+    file_lock();
+    file_close(region->file);
+    file_unlock();
+    free(region);
+}
 
+// undo the mmap with the given id, if the current process has one
+void page_munmap(int id) {
+    struct thread *cur = thread_current();
+    for(struct list_elem *e = list_begin(&cur->mmap_list); e != list_end(&cur->mmap_list); e = list_next(e)) {
+        struct page_mmap_region *region = list_entry(e, struct page_mmap_region, elem);
+        if(region->id == id) {
+            page_unmap_region(cur, region);
+            return;
+        }
+    }
+}
+
+// undo every mmap of the current process, called on exit
+void page_munmap_all(void) {
+    struct thread *cur = thread_current();
+    while(!list_empty(&cur->mmap_list)) {
+        page_unmap_region(cur, list_entry(list_front(&cur->mmap_list), struct page_mmap_region, elem));
+    }
+}
+
+/* Copy pentry of parent at upage into the page table of the current thread.
+ a resident page is shared copy-on-write, a swapped page gets a slot of its own,
+ a page still in the executable is loaded from there again. mmap pages are left out. */
+static bool page_fork_entry(void *upage, struct page_table_entry *pentry, void *parent_){
+    struct thread *parent = parent_;
+    struct thread *cur = thread_current();
+    if(pentry->file != NULL) {
+        return true;
+    }
+    struct page_table_entry *entry = page_insert(cur->page_table, upage);
+    if(entry == NULL) {
+        return false;
+    }
+    // retry if the page is evicted under our feet
+    while(pentry->status == FRAME) {
+        bool dirty = pagedir_is_dirty(parent->pagedir, upage);
+        bool was_cow = pentry->cow;
+        pentry->cow = pentry->writable;
+        void *kpage = frame_fork_fr((void*)pentry->val, parent, cur, upage, pentry->writable);
+        if(kpage != NULL) {
+            *entry = *pentry;
+            entry->from_file = pentry->from_file && !dirty;
+            // the slot stays with parent
+            entry->swap_cached = false;
+            pagedir_set_page(cur->pagedir, upage, kpage, false);
+            frame_unpin_fr(kpage);
+            return true;
+        }
+        if(pentry->status == FRAME) {
+            pentry->cow = was_cow;
+            page_remove(entry);
+            return false;
+        }
+    }
+    *entry = *pentry;
+    if(pentry->status == SWAP) {
+        entry->val = swap_dup(pentry->val);
+        if(entry->val == (uint32_t)-1) {
+            page_remove(entry);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Duplicate the address space of parent, which is blocked in fork(), into the current thread.
+ mmap regions are not inherited. on failure the pages copied so far stay in the
+ current thread's table and go away with it. */
+bool page_fork(struct thread *parent) {
+    struct thread *cur = thread_current();
+    lock_acquire(&parent->page_table_lock);
+    lock_acquire(&cur->page_table_lock);
+    bool success = page_for_each(parent->page_table, page_fork_entry, parent);
+    lock_release(&cur->page_table_lock);
+    lock_release(&parent->page_table_lock);
+    return success;
+}
+
+//print zero page statistics
+void page_print_stats(void) {
+    printf("Page: %lld reads served by the zero page, %lld pages zero-filled\n",
+           page_zero_map_cnt, page_zero_fill_cnt);
+    printf("Page: %lld pages mapped by fault-around, %lld of them accessed\n",
+           page_around_cnt, page_around_used_cnt);
+    printf("Page: %lld clean evictions went back to their swap slot\n",
+           page_swap_cache_hit_cnt);
+    printf("Page: %lld user pages pinned for system calls, %lld faulted in to pin them\n",
+           page_pin_cnt, page_pin_fault_cnt);
+    printf("Page: %lld 4 MB pages mapped\n", page_large_cnt);
+    printf("Page: %lld mapped pages released at exit in %lld batches\n",
+           page_release_page_cnt, page_release_batch_cnt);
+}
@@ -7,35 +7,76 @@
 
 #include "devices/block.h"
 #include "lib/kernel/list.h"
-#include "lib/kernel/hash.h"
 #include "threads/palloc.h"
 enum page_status {
+    NONE,       // free slot of the page table
     FRAME,
     SWAP,
-    FILE
+    FILE,
+    MMAP,
+    ZERO        // reads as zeros, has no frame of its own until written
 };
 
+//one slot of the page table, 16 bytes so that a page of them fits a power of two
 struct page_table_entry {
-    void *key;
     uint32_t val;
     /*
      kpage for frame
      index for swap
-     offset for file
+     offset for file and mmap
      */
-    enum page_status status;
-    uint32_t page_read_bytes;
-    bool writable;
-    struct hash_elem he;
+    union {
+        uint32_t file_ofs;
+        uint32_t swap_slot;     // of a swap_cached page
+    };
+    struct file *file;  // mapped file of an mmap page, written back instead of swapped
+    uint16_t page_read_bytes;
+    uint8_t status;     // enum page_status
+    bool writable : 1;
+    bool from_file : 1; // clean copy can be re-read from exec_file at file_ofs
+    bool cow : 1;       // writable page mapped read-only, shared with a forked process
+    bool swap_cached : 1;   // resident page that still owns the swap slot it was read from
 };
+
+//default and largest number of pages mapped along with a FILE fault, see -fa
+#define PAGE_FAULT_AROUND 8
+#define PAGE_FAULT_AROUND_MAX 16
+extern size_t page_fault_around;
+//see -lp
+extern bool page_large;
+
+//two-level radix table of page_table_entry keyed by virtual page number, see page.c
+struct page_table;
+
+//a region made by mmap, page_cnt pages from addr backed by file
+struct page_mmap_region {
+    int id;
+    struct file *file;
+    void *addr;
+    size_t page_cnt;
+    struct list_elem elem;
+};
+
 void page_init();
 /* basic life cycle *
  */
-struct hash *page_create_table();
-struct page_table_entry* page_find(struct hash *page_table, void *upage);
-bool page_evict_upage(struct thread *holder, void *upage, uint32_t index);
-void page_destroy_table(struct hash *page_table);
+struct page_table *page_create_table();
+struct page_table_entry* page_find(struct page_table *page_table, const void *upage);
+bool page_evict_upage(struct thread *holder, void *upage);
+bool page_needs_swap(struct thread *holder, void *upage);
+bool page_evict_cluster(struct thread *holder, void *upage, size_t cnt);
+void page_destroy_table(struct page_table *page_table);
 bool page_fault_handler(const void *vaddr, bool to_write, void *esp);
+//fault in and pin user memory the kernel is about to access, so it can do so under locks
+//that the fault path takes. see page.c
+bool page_pin_range(const void *uaddr, size_t size, bool write);
+void page_unpin_range(const void *uaddr, size_t size);
+size_t page_pin_string(const char *str);
 bool page_set_frame(void *upage, void *kpage, bool writable);
+int page_mmap(struct file *file, void *addr, uint32_t length);
+void page_munmap(int id);
+void page_munmap_all(void);
+bool page_fork(struct thread *parent);
+void page_print_stats(void);
 
 #endif
\ No newline at end of file
@@ -1,71 +1,186 @@
 #include <stdio.h>
+#include <bitmap.h>
 #include "page.h"
 #include "frame.h"
 #include "swap.h"
-#include "threads/malloc.h"
+#include "zswap.h"
+#include "threads/synch.h"
 #include "threads/vaddr.h"
 // Created by zhangyifan on 2024/4/2.
-//store the empty swap slot. reuse them later.
-static struct list swap_slot_list;
 struct block* swap_block;
-block_sector_t max_index = 0;
+//one bit per page-sized slot, true if the slot is in use
+static struct bitmap *swap_map;
+//slot where the next search starts, so allocations rotate over the device
+static size_t swap_cursor;
+//protects swap_map and swap_cursor
+static struct lock swap_lock;
 const int sector_per_page= PGSIZE / BLOCK_SECTOR_SIZE;
+//identifiers with this bit set name slots of the compressed tier rather than of the device,
+//slot s is SWAP_IN_RAM | s * sector_per_page so that a cluster still gets consecutive identifiers
+#define SWAP_IN_RAM 0x40000000
+//compressed-tier slots handed to zswap_free_batch at a time by swap_free_batch
+#define SWAP_FREE_BATCH 16
+//statistics
+static long long swap_out_cnt;
+static long long swap_in_cnt;
+static long long swap_ram_in_cnt;
 
 void swap_init(){
     swap_block = block_get_role(BLOCK_SWAP);
     ASSERT(swap_block != NULL);
-    list_init(&swap_slot_list);
+    swap_map = bitmap_create(block_size(swap_block) / sector_per_page);
+    if (swap_map == NULL)
+        PANIC("bitmap creation failed--swap device is too large");
+    swap_cursor = 0;
+    lock_init(&swap_lock);
+    zswap_init();
+}
+
+static size_t swap_ram_slot(block_sector_t index) {
+    return (index & ~SWAP_IN_RAM) / sector_per_page;
 }
 
 //store the content of a kpage(frame) to a swap slot(on the disk)
 //return an identifier of the swap slot
 block_sector_t swap_store(void *kpage) {
-    ASSERT(is_kernel_vaddr(kpage));
-    block_sector_t index=swap_get_swap_slot();
+    return swap_store_cluster(&kpage, 1);
+}
+
+//store cnt kpages to cnt contiguous swap slots, kpages[i] goes to the i-th slot
+//return the identifier of the first slot.
+//the compressed tier is tried first, the whole cluster goes to the device if any page does not fit
+block_sector_t swap_store_cluster(void **kpages, size_t cnt) {
+    size_t slot = zswap_store(kpages, cnt);
+    if(slot != (size_t)-1){
+        return SWAP_IN_RAM | slot * sector_per_page;
+    }
+    block_sector_t index=swap_get_swap_slots(cnt);
     if(index==(block_sector_t)(-1)){
         return -1;
     }
-    for(int i=0;i<sector_per_page;i++){
-        block_write(swap_block,index+i,(void*)((uint32_t)kpage+i*BLOCK_SECTOR_SIZE));
+    for(size_t p=0;p<cnt;p++){
+        ASSERT(is_kernel_vaddr(kpages[p]));
+        block_write_multiple(swap_block,index+p*sector_per_page,sector_per_page,kpages[p]);
     }
+    swap_out_cnt+=cnt;
     return index;
 }
 
+//read a swap slot to the kpage(frame), the slot stays allocated
+static void swap_read(block_sector_t index, void *kpage) {
+    ASSERT((int)index>=0 && index % sector_per_page == 0);
+    if(index & SWAP_IN_RAM){
+        zswap_load(swap_ram_slot(index), kpage);
+        return;
+    }
+    block_read_multiple(swap_block,index,sector_per_page,kpage);
+}
+
 //load a swap slot to the kpage(frame)
 //index must be got from swap_store()
 void swap_load(block_sector_t index, void *kpage) {
+    swap_load_cached(index, kpage);
+    swap_free_swap_slot(index);
+}
+
+//load a swap slot to the kpage(frame) but keep the slot,
+//so a clean page can be dropped again without writing it
+void swap_load_cached(block_sector_t index, void *kpage) {
     ASSERT(is_kernel_vaddr(kpage));
+    swap_read(index, kpage);
+    if(index & SWAP_IN_RAM){
+        swap_ram_in_cnt++;
+    }else{
+        swap_in_cnt++;
+    }
+}
+
+//copy the content of swap slot index to a new slot, for a forked child.
+//return the identifier of the new slot, or -1 if swap is full
+block_sector_t swap_dup(block_sector_t index) {
     ASSERT((int)index>=0 && index % sector_per_page == 0);
-    for(int i=0;i<sector_per_page;i++){
-        block_read(swap_block,index+i,(void*)((uint32_t)kpage+i*BLOCK_SECTOR_SIZE));
+    void *buffer = palloc_get_page(0);
+    if(buffer == NULL){
+        return -1;
     }
-    swap_free_swap_slot(index);
+    swap_read(index, buffer);
+    block_sector_t copy = swap_store(buffer);
+    palloc_free_page(buffer);
+    return copy;
 }
 
 //free a swap slot whose identifier is index
 //index must be got from swap_store()
 void swap_free_swap_slot(block_sector_t index){
+    swap_free_swap_slots(index, 1);
+}
+
+block_sector_t swap_get_swap_slot(){
+    return swap_get_swap_slots(1);
+}
+
+//allocate cnt page-sized slots that are contiguous on the swap device
+//search from the cursor to the end first, then wrap around
+block_sector_t swap_get_swap_slots(size_t cnt){
+    ASSERT(cnt > 0);
+    lock_acquire(&swap_lock);
+    size_t slot = bitmap_scan_and_flip(swap_map, swap_cursor, cnt, false);
+    if (slot == BITMAP_ERROR && swap_cursor != 0) {
+        slot = bitmap_scan_and_flip(swap_map, 0, cnt, false);
+    }
+    if (slot != BITMAP_ERROR) {
+        swap_cursor = (slot + cnt) % bitmap_size(swap_map);
+    }
+    lock_release(&swap_lock);
+    return slot != BITMAP_ERROR ? (block_sector_t)(slot * sector_per_page) : (block_sector_t)-1;
+}
+
+//free cnt contiguous slots got from swap_get_swap_slots()
+void swap_free_swap_slots(block_sector_t index, size_t cnt){
     ASSERT(index % sector_per_page == 0);
-    if (index == max_index - sector_per_page){
-        max_index -= sector_per_page;
-    }else{
-        struct swap_slot* slot= malloc(sizeof(struct swap_slot));
-        slot->index = index;
-        list_push_back(&swap_slot_list, &slot->le);
+    if(index & SWAP_IN_RAM){
+        for(size_t i = 0; i < cnt; i++){
+            zswap_free(swap_ram_slot(index) + i);
+        }
+        return;
     }
+    size_t slot = index / sector_per_page;
+    lock_acquire(&swap_lock);
+    ASSERT(bitmap_all(swap_map, slot, cnt));
+    bitmap_set_multiple(swap_map, slot, cnt, false);
+    lock_release(&swap_lock);
 }
 
-block_sector_t swap_get_swap_slot(){
-    if (!list_empty(&swap_slot_list)){
-        struct swap_slot* slot = list_entry(list_pop_front(&swap_slot_list), struct swap_slot, le);
-        int index=slot->index;
-        free(slot);
-        return index;
-    }else{
-        if (max_index + sector_per_page < block_size(swap_block)){
-            max_index += sector_per_page;
-            return max_index - sector_per_page;
+//free the cnt slots in indexes, each got from swap_store(), in one pass over swap_map
+//and in batches of SWAP_FREE_BATCH for the compressed tier
+void swap_free_batch(const block_sector_t *indexes, size_t cnt){
+    size_t ram[SWAP_FREE_BATCH];
+    size_t ram_cnt = 0;
+    lock_acquire(&swap_lock);
+    for(size_t i = 0; i < cnt; i++){
+        if(!(indexes[i] & SWAP_IN_RAM)){
+            ASSERT(indexes[i] % sector_per_page == 0);
+            ASSERT(bitmap_test(swap_map, indexes[i] / sector_per_page));
+            bitmap_reset(swap_map, indexes[i] / sector_per_page);
         }
     }
-    return (block_sector_t)-1;
-}
\ No newline at end of file
+    lock_release(&swap_lock);
+    for(size_t i = 0; i < cnt; i++){
+        if(indexes[i] & SWAP_IN_RAM){
+            ram[ram_cnt++] = swap_ram_slot(indexes[i]);
+        }
+        if(ram_cnt == SWAP_FREE_BATCH || (ram_cnt > 0 && i == cnt - 1)){
+            zswap_free_batch(ram, ram_cnt);
+            ram_cnt = 0;
+        }
+    }
+}
+
+//print swap traffic statistics
+void swap_print_stats(void) {
+    long long in = swap_in_cnt + swap_ram_in_cnt;
+    printf("Swap: %lld pages out, %lld pages in\n", swap_out_cnt, swap_in_cnt);
+    printf("Swap: %lld pages in from the compressed tier, %lld%% hit rate\n",
+           swap_ram_in_cnt, in > 0 ? swap_ram_in_cnt * 100 / in : 0);
+    zswap_print_stats();
+}
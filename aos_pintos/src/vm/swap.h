@@ -4,14 +4,11 @@
 
 #ifndef VM_SWAP_H
 #define VM_SWAP_H
+#include <stddef.h>
 #include "devices/block.h"
-#include "lib/kernel/list.h"
-#include "lib/kernel/hash.h"
 
-struct swap_slot{
-    block_sector_t index;
-    struct list_elem le;
-};
+//most pages written to swap by one clustered swap-out
+#define SWAP_CLUSTER 8
 
 //initialize swap when kernel starts
 //used in thread/init.c
@@ -25,8 +22,31 @@ block_sector_t swap_store(void *kpage);
 //index must be got from swap_store()
 void swap_load(block_sector_t index, void *kpage);
 
+//load a swap slot to the kpage(frame), the slot stays allocated
+//until it is freed with swap_free_swap_slot()
+void swap_load_cached(block_sector_t index, void *kpage);
+
+//store cnt kpages to cnt contiguous swap slots, kpages[i] goes to the i-th slot
+//return the identifier of the first slot, or -1 if no such run is free
+block_sector_t swap_store_cluster(void **kpages, size_t cnt);
+
+//copy swap slot index to a new slot, index stays allocated
+//return the identifier of the new slot, or -1 if swap is full
+block_sector_t swap_dup(block_sector_t index);
+
 void swap_free_swap_slot(block_sector_t index);
 block_sector_t swap_get_swap_slot();
 
+//allocate cnt page-sized slots that are contiguous on the swap device
+//return the identifier of the first one, the i-th is that plus i*PGSIZE/BLOCK_SECTOR_SIZE
+//return -1 if no such run is free
+block_sector_t swap_get_swap_slots(size_t cnt);
+//free cnt contiguous slots got from swap_get_swap_slots()
+void swap_free_swap_slots(block_sector_t index, size_t cnt);
+//free the cnt slots in indexes, each got from swap_store(), taking each lock once
+void swap_free_batch(const block_sector_t *indexes, size_t cnt);
+
+//print swap traffic statistics
+void swap_print_stats(void);
 
 #endif //AOS_PROJECT3_SWAP_H
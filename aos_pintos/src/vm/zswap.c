@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <bitmap.h>
+#include "zswap.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "lib/debug.h"
+#include "lib/string.h"
+#include <round.h>
+
+//the pool, carved into chunks; a compressed page takes a run of them
+#define ZSWAP_POOL_PAGES 64
+#define ZSWAP_CHUNK 128
+#define ZSWAP_CHUNK_CNT (ZSWAP_POOL_PAGES * PGSIZE / ZSWAP_CHUNK)
+//a page is only kept if it compresses to at most this many bytes
+#define ZSWAP_MAX_SIZE (PGSIZE * 3 / 4)
+//same-filled pages take a slot but no chunks, so there are more slots than pages fit
+#define ZSWAP_SLOT_CNT (ZSWAP_CHUNK_CNT / 2)
+
+//the compressed stream is a sequence of
+//  0nnnnnnn followed by n+1 literal bytes, or
+//  1lllllll ofs_lo ofs_hi, copy l+LZ_MIN_MATCH bytes starting ofs bytes back
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (0x7f + LZ_MIN_MATCH)
+#define LZ_MAX_LITERALS 0x80
+#define LZ_HASH_BITS 12
+
+struct zswap_slot{
+    uint16_t chunk;         // first chunk of the data
+    uint16_t chunk_cnt;     // 0 for a same-filled page
+    uint16_t size;          // bytes of compressed data
+    uint32_t fill;          // the word a same-filled page is made of
+};
+
+static uint8_t *pool;
+//one bit per chunk of the pool and per slot, true if in use
+static struct bitmap *chunk_map;
+static struct bitmap *slot_map;
+static struct zswap_slot slots[ZSWAP_SLOT_CNT];
+//protects everything above and the scratch space of the compressor
+static struct lock zswap_lock;
+//position+1 of the last 3-byte sequence with each hash, 0 if none
+static uint16_t lz_table[1 << LZ_HASH_BITS];
+static uint8_t lz_buf[ZSWAP_MAX_SIZE];
+
+//statistics
+static long long zswap_store_cnt;
+static long long zswap_same_cnt;
+static long long zswap_reject_cnt;
+static long long zswap_full_cnt;
+static long long zswap_bytes_in;
+static long long zswap_bytes_out;
+static size_t zswap_chunk_used;
+static size_t zswap_chunk_peak;
+
+void zswap_init(void) {
+    pool = palloc_get_multiple(PAL_ASSERT, ZSWAP_POOL_PAGES);
+    chunk_map = bitmap_create(ZSWAP_CHUNK_CNT);
+    slot_map = bitmap_create(ZSWAP_SLOT_CNT);
+    if (chunk_map == NULL || slot_map == NULL)
+        PANIC("zswap bitmap creation failed");
+    lock_init(&zswap_lock);
+}
+
+static unsigned lz_hash(const uint8_t *p) {
+    uint32_t v = p[0] | p[1] << 8 | p[2] << 16;
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+//append src[from, to) to dst as literal runs
+static bool lz_literals(const uint8_t *src, size_t from, size_t to, uint8_t *dst, size_t *out, size_t limit) {
+    while (from < to) {
+        size_t n = to - from < LZ_MAX_LITERALS ? to - from : LZ_MAX_LITERALS;
+        if (*out + 1 + n > limit) {
+            return false;
+        }
+        dst[(*out)++] = n - 1;
+        memcpy(dst + *out, src + from, n);
+        *out += n;
+        from += n;
+    }
+    return true;
+}
+
+//compress a page into at most limit bytes of dst.
+//return the compressed size, or 0 if it does not fit
+static size_t lz_compress(const uint8_t *src, uint8_t *dst, size_t limit) {
+    size_t in = 0, out = 0, lit = 0;
+    memset(lz_table, 0, sizeof lz_table);
+    while (in + LZ_MIN_MATCH <= PGSIZE) {
+        unsigned h = lz_hash(src + in);
+        size_t cand = lz_table[h];
+        size_t len = 0;
+        lz_table[h] = in + 1;
+        if (cand != 0) {
+            cand--;
+            while (len < LZ_MAX_MATCH && in + len < PGSIZE && src[cand + len] == src[in + len]) {
+                len++;
+            }
+        }
+        if (len < LZ_MIN_MATCH) {
+            in++;
+            continue;
+        }
+        if (!lz_literals(src, lit, in, dst, &out, limit) || out + 3 > limit) {
+            return 0;
+        }
+        dst[out++] = 0x80 | (len - LZ_MIN_MATCH);
+        dst[out++] = (in - cand) & 0xff;
+        dst[out++] = (in - cand) >> 8;
+        in += len;
+        lit = in;
+    }
+    if (!lz_literals(src, lit, PGSIZE, dst, &out, limit)) {
+        return 0;
+    }
+    return out;
+}
+
+static void lz_decompress(const uint8_t *src, size_t size, uint8_t *dst) {
+    size_t in = 0, out = 0;
+    while (in < size) {
+        uint8_t c = src[in++];
+        if (c & 0x80) {
+            size_t len = (c & 0x7f) + LZ_MIN_MATCH;
+            size_t ofs = src[in] | src[in + 1] << 8;
+            in += 2;
+            //byte by byte, the match may overlap what it produces
+            for (; len > 0; len--, out++) {
+                dst[out] = dst[out - ofs];
+            }
+        } else {
+            memcpy(dst + out, src + in, c + 1);
+            in += c + 1;
+            out += c + 1;
+        }
+    }
+    ASSERT(out == PGSIZE);
+}
+
+//true if the page is one word repeated, stored into *fill
+static bool zswap_same_filled(const void *kpage, uint32_t *fill) {
+    const uint32_t *words = kpage;
+    for (size_t i = 1; i < PGSIZE / sizeof *words; i++) {
+        if (words[i] != words[0]) {
+            return false;
+        }
+    }
+    *fill = words[0];
+    return true;
+}
+
+static void zswap_release(size_t slot) {
+    struct zswap_slot *s = &slots[slot];
+    if (s->chunk_cnt > 0) {
+        bitmap_set_multiple(chunk_map, s->chunk, s->chunk_cnt, false);
+        zswap_chunk_used -= s->chunk_cnt;
+    }
+    bitmap_reset(slot_map, slot);
+}
+
+//compress kpage into slot, must hold zswap_lock
+static bool zswap_store_page(size_t slot, void *kpage) {
+    struct zswap_slot *s = &slots[slot];
+    if (zswap_same_filled(kpage, &s->fill)) {
+        s->chunk_cnt = 0;
+        s->size = sizeof s->fill;
+    } else {
+        size_t size = lz_compress(kpage, lz_buf, ZSWAP_MAX_SIZE);
+        if (size == 0) {
+            zswap_reject_cnt++;
+            return false;
+        }
+        size_t cnt = DIV_ROUND_UP(size, ZSWAP_CHUNK);
+        size_t chunk = bitmap_scan_and_flip(chunk_map, 0, cnt, false);
+        if (chunk == BITMAP_ERROR) {
+            zswap_full_cnt++;
+            return false;
+        }
+        memcpy(pool + chunk * ZSWAP_CHUNK, lz_buf, size);
+        s->chunk = chunk;
+        s->chunk_cnt = cnt;
+        s->size = size;
+        zswap_chunk_used += cnt;
+    }
+    return true;
+}
+
+//compress cnt kpages into cnt consecutive slots, kpages[i] goes to the i-th slot.
+//all or none of them are stored
+size_t zswap_store(void **kpages, size_t cnt) {
+    lock_acquire(&zswap_lock);
+    size_t slot = bitmap_scan_and_flip(slot_map, 0, cnt, false);
+    if (slot == BITMAP_ERROR) {
+        zswap_full_cnt++;
+        lock_release(&zswap_lock);
+        return -1;
+    }
+    for (size_t i = 0; i < cnt; i++) {
+        if (!zswap_store_page(slot + i, kpages[i])) {
+            bitmap_set_multiple(slot_map, slot + i, cnt - i, false);
+            while (i-- > 0) {
+                zswap_release(slot + i);
+            }
+            lock_release(&zswap_lock);
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < cnt; i++) {
+        zswap_same_cnt += slots[slot + i].chunk_cnt == 0;
+        zswap_bytes_out += slots[slot + i].size;
+    }
+    zswap_store_cnt += cnt;
+    zswap_bytes_in += cnt * PGSIZE;
+    if (zswap_chunk_used > zswap_chunk_peak) {
+        zswap_chunk_peak = zswap_chunk_used;
+    }
+    lock_release(&zswap_lock);
+    return slot;
+}
+
+void zswap_load(size_t slot, void *kpage) {
+    ASSERT(slot < ZSWAP_SLOT_CNT);
+    lock_acquire(&zswap_lock);
+    ASSERT(bitmap_test(slot_map, slot));
+    struct zswap_slot *s = &slots[slot];
+    if (s->chunk_cnt == 0) {
+        uint32_t *words = kpage;
+        for (size_t i = 0; i < PGSIZE / sizeof *words; i++) {
+            words[i] = s->fill;
+        }
+    } else {
+        lz_decompress(pool + s->chunk * ZSWAP_CHUNK, s->size, kpage);
+    }
+    lock_release(&zswap_lock);
+}
+
+void zswap_free(size_t slot) {
+    ASSERT(slot < ZSWAP_SLOT_CNT);
+    lock_acquire(&zswap_lock);
+    ASSERT(bitmap_test(slot_map, slot));
+    zswap_release(slot);
+    lock_release(&zswap_lock);
+}
+
+void zswap_free_batch(const size_t *slots, size_t cnt) {
+    lock_acquire(&zswap_lock);
+    for (size_t i = 0; i < cnt; i++) {
+        ASSERT(slots[i] < ZSWAP_SLOT_CNT);
+        ASSERT(bitmap_test(slot_map, slots[i]));
+        zswap_release(slots[i]);
+    }
+    lock_release(&zswap_lock);
+}
+
+void zswap_print_stats(void) {
+    if (pool == NULL) {
+        return;
+    }
+    long long ratio = zswap_bytes_out > 0 ? zswap_bytes_in * 100 / zswap_bytes_out : 0;
+    printf("Zswap: %lld pages stored (%lld same-filled), %lld did not compress, %lld found the pool full\n",
+           zswap_store_cnt, zswap_same_cnt, zswap_reject_cnt, zswap_full_cnt);
+    printf("Zswap: compression ratio %lld.%02lld, %zu of %d chunks in use, peak %zu\n",
+           ratio / 100, ratio % 100, zswap_chunk_used,
+           ZSWAP_CHUNK_CNT, zswap_chunk_peak);
+}
@@ -0,0 +1,28 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+#include <stddef.h>
+
+//compressed in-memory tier in front of the swap device.
+//pages are kept compressed in a fixed pool of kernel pages,
+//a page made of one repeated word is kept as that word alone.
+
+//allocate the pool, called by swap_init()
+void zswap_init(void);
+
+//compress cnt kpages into cnt consecutive slots, kpages[i] goes to the i-th slot
+//return the first slot, or -1 if the pool is full or a page does not compress
+size_t zswap_store(void **kpages, size_t cnt);
+
+//decompress slot into kpage, the slot stays allocated
+void zswap_load(size_t slot, void *kpage);
+
+//free a slot got from zswap_store()
+void zswap_free(size_t slot);
+
+//free cnt slots got from zswap_store(), taking the pool lock once
+void zswap_free_batch(const size_t *slots, size_t cnt);
+
+//print compression and pool statistics
+void zswap_print_stats(void);
+
+#endif